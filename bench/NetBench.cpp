@@ -0,0 +1,484 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    NetBench.cpp
+ * ----------------------------------------------------------------------------
+ */
+/* Load test for Server. Runs a server on one thread and drives many
+ * simulated clients from another, all over loopback. Simulated clients speak
+ * the wire protocol directly on their own sockets, acknowledging the roster
+ * channel with a ReliableEndpoint, so thousands fit in one process. They
+ * join at a steady rate, send a SnapshotAck at a fixed rate once joined, and
+ * leave and rejoin to create churn, while the server broadcasts a Snapshot
+ * to everyone at a fixed rate.
+ *
+ * Usage: netbench [-c clients] [-d seconds] [-r packets per second per
+ *                 client] [-b broadcasts per second] [-s snapshot bytes]
+ *                 [-j joins per second] [-l leaves per second] [-p port]
+ *                 [-w capture file of the server's traffic]
+ */
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include "Server.h"
+using namespace wic;
+using std::vector;
+
+/** Benchmark parameters. */
+struct Settings
+{
+  Settings();
+  unsigned clients;
+  double duration;
+  double sendRate;
+  double broadcastRate;
+  size_t snapshotSize;
+  double joinRate;
+  double leaveRate;
+  unsigned port;
+  const char* capture;
+};
+Settings::Settings()
+: clients(1000), duration(10.0), sendRate(10.0), broadcastRate(20.0),
+  snapshotSize(100), joinRate(500.0), leaveRate(10.0), port(40100),
+  capture(nullptr)
+{
+}
+
+/** What the server thread measured. */
+struct ServerStats
+{
+  ServerStats();
+  size_t received;        // SnapshotAcks delivered by recvBatch
+  size_t broadcasts;
+  size_t recipients;      // clients connected at each broadcast, summed
+  size_t errors;
+  double recvCPU;         // seconds spent in recvBatch calls that got some
+  double idleCPU;         // seconds spent in iterations that got nothing
+  double sendCPU;         // seconds spent in sendAll and update
+  double totalCPU;
+};
+ServerStats::ServerStats()
+: received(0), broadcasts(0), recipients(0), errors(0), recvCPU(0.0),
+  idleCPU(0.0), sendCPU(0.0), totalCPU(0.0)
+{
+}
+
+/** A client simulated on a bare socket. */
+struct SimClient
+{
+  enum State { IDLE, JOINING, JOINED };
+  SimClient();
+  int fd;
+  State state;
+  NodeID ID;
+  NetClock::time_point joinSent;
+  NetClock::time_point nextAction; // next send, or next join attempt
+  std::unique_ptr<ReliableEndpoint> reliable;
+  bool ackOwed;
+  uint32_t latest;                 // newest snapshot tick recieved
+};
+SimClient::SimClient()
+: fd(-1), state(IDLE), ID(0), ackOwed(false), latest(0)
+{
+}
+
+double threadCPU()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+double seconds(NetClock::duration duration)
+{
+  return std::chrono::duration<double>(duration).count();
+}
+NetClock::duration toDuration(double seconds)
+{
+  return std::chrono::duration_cast<NetClock::duration>(
+    std::chrono::duration<double>(seconds));
+}
+double percentile(const vector<double>& sorted, double fraction)
+{
+  if(sorted.empty())
+    return 0.0;
+  size_t index = (size_t) (fraction * (sorted.size() - 1) + 0.5);
+  return sorted[index];
+}
+
+/** Runs the server until stopped, broadcasting snapshots at a fixed rate. */
+void serve(Server* server, const Settings* settings, std::atomic<bool>* stop,
+           ServerStats* stats)
+{
+  vector<PacketView> views;
+  vector<uint8_t> payload(settings->snapshotSize, 0xAB);
+  NetClock::duration period = toDuration(1.0 / settings->broadcastRate);
+  NetClock::time_point nextBroadcast = NetClock::now();
+  uint32_t tick = 1;
+  double start = threadCPU();
+  while(!stop->load())
+  {
+    double before = threadCPU();
+    size_t count = 0;
+    try
+    {
+      count = server->recvBatch(views, Node::RING_SIZE);
+    }
+    catch(const Failure& failure)
+    {
+      if(stats->errors++ == 0)
+        fprintf(stderr, "server: %s\n", failure.what());
+    }
+    
+    // Iterations that recieve nothing are idle time, not a cost of packets
+    double after = threadCPU();
+    if(count > 0)
+      stats->recvCPU += after - before;
+    else
+      stats->idleCPU += after - before;
+    for(size_t i = 0; i < count; i++)
+    {
+      if(views[i].isType<SnapshotAck>())
+        stats->received++;
+    }
+    
+    NetClock::time_point now = NetClock::now();
+    if(now >= nextBroadcast)
+    {
+      nextBroadcast += period;
+      if(nextBroadcast < now)
+        nextBroadcast = now + period;
+      for(NodeID i = 1; i <= server->getMaxID(); i++)
+      {
+        if(server->isUsed(i))
+          stats->recipients++;
+      }
+      before = threadCPU();
+      server->sendAll(Snapshot(tick++, 0, payload.data(), payload.size()));
+      server->update();
+      stats->sendCPU += threadCPU() - before;
+      stats->broadcasts++;
+    }
+    else
+    {
+      before = threadCPU();
+      server->update();
+      if(count > 0)
+        stats->sendCPU += threadCPU() - before;
+      else
+        stats->idleCPU += threadCPU() - before;
+    }
+    if(count == 0)
+      std::this_thread::yield();
+  }
+  stats->totalCPU = threadCPU() - start;
+}
+
+/** Drives the simulated clients. */
+class Driver
+{
+public:
+  Driver(const Settings& settings);
+  ~Driver();
+  void run(NetClock::time_point end);
+  size_t sent;
+  size_t snapshots;
+  size_t joins;
+  size_t leaves;
+  size_t retries;
+  size_t refused;
+  vector<double> joinLatencies;
+private:
+  void join(SimClient& client, NetClock::time_point now);
+  void leave(SimClient& client, NetClock::time_point now);
+  void drain(SimClient& client, NetClock::time_point now);
+  void handle(SimClient& client, const PacketView& packet,
+              NetClock::time_point now);
+  const Settings& settings;
+  vector<SimClient> clients;
+  vector<struct pollfd> fds;
+  vector<size_t> connected;        // indices of joined clients
+  vector<uint8_t> unwrapped;
+  uint8_t buffer[Node::MTU];
+};
+Driver::Driver(const Settings& settings)
+: sent(0), snapshots(0), joins(0), leaves(0), retries(0), refused(0),
+  settings(settings), clients(settings.clients), fds(settings.clients)
+{
+  struct sockaddr_in serverAddr;
+  bzero(&serverAddr, sizeof(serverAddr));
+  serverAddr.sin_family = AF_INET;
+  serverAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  serverAddr.sin_port = htons(settings.port);
+  for(size_t i = 0; i < clients.size(); i++)
+  {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr*) &serverAddr,
+                         sizeof(serverAddr)) != 0)
+    {
+      fprintf(stderr, "could not open socket %zu\n", i);
+      exit(1);
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    clients[i].fd = fd;
+    fds[i].fd = fd;
+    fds[i].events = POLLIN;
+  }
+}
+Driver::~Driver()
+{
+  for(size_t i = 0; i < clients.size(); i++)
+    close(clients[i].fd);
+}
+void Driver::run(NetClock::time_point end)
+{
+  NetClock::time_point start = NetClock::now();
+  NetClock::duration sendPeriod = toDuration(1.0 / settings.sendRate);
+  size_t started = 0;
+  double churned = 0.0;
+  NetClock::time_point now = start;
+  while(now < end)
+  {
+    // Ramp up, then hold the population steady while churning
+    double elapsed = seconds(now - start);
+    while(started < clients.size() && started < settings.joinRate * elapsed)
+      join(clients[started++], now);
+    if(started == clients.size())
+    {
+      while(churned < settings.leaveRate * elapsed && !connected.empty())
+      {
+        size_t pick = rand() % connected.size();
+        leave(clients[connected[pick]], now);
+        connected[pick] = connected.back();
+        connected.pop_back();
+        churned += 1.0;
+      }
+    }
+    
+    // Rejoin, retry, and send traffic
+    for(size_t i = 0; i < started; i++)
+    {
+      SimClient& client = clients[i];
+      if(now < client.nextAction)
+        continue;
+      if(client.state == SimClient::IDLE)
+        join(client, now);
+      else if(client.state == SimClient::JOINING)
+      {
+        retries++;
+        join(client, now);
+      }
+      else
+      {
+        size_t length = SnapshotAck(client.latest).toBuffer(buffer, Node::MTU,
+                                                           client.ID);
+        send(client.fd, buffer, length, 0);
+        sent++;
+        client.nextAction += sendPeriod;
+        if(client.nextAction < now)
+          client.nextAction = now + sendPeriod;
+      }
+    }
+    
+    // Recieve, then acknowledge the roster channel
+    if(poll(fds.data(), started, 1) > 0)
+    {
+      now = NetClock::now();
+      for(size_t i = 0; i < started; i++)
+      {
+        if(fds[i].revents & POLLIN)
+          drain(clients[i], now);
+      }
+    }
+    for(size_t i = 0; i < started; i++)
+    {
+      SimClient& client = clients[i];
+      if(!client.ackOwed)
+        continue;
+      client.ackOwed = false;
+      size_t length;
+      while((length = client.reliable->emit(now, client.ID, buffer,
+                                            Node::MTU)) > 0)
+        send(client.fd, buffer, length, 0);
+    }
+    now = NetClock::now();
+  }
+}
+void Driver::join(SimClient& client, NetClock::time_point now)
+{
+  // Keep the time of the first attempt so retries count against latency
+  if(client.state != SimClient::JOINING)
+    client.joinSent = now;
+  client.state = SimClient::JOINING;
+  client.nextAction = now + std::chrono::seconds(1);
+  size_t length = JoinRequest("sim").toBuffer(buffer, Node::MTU, 0);
+  send(client.fd, buffer, length, 0);
+}
+void Driver::leave(SimClient& client, NetClock::time_point now)
+{
+  size_t length = Leaving().toBuffer(buffer, Node::MTU, client.ID);
+  send(client.fd, buffer, length, 0);
+  client.state = SimClient::IDLE;
+  client.nextAction = now + std::chrono::milliseconds(100);
+  client.reliable.reset();
+  client.ackOwed = false;
+  leaves++;
+}
+void Driver::drain(SimClient& client, NetClock::time_point now)
+{
+  ssize_t length;
+  while((length = recv(client.fd, buffer, Node::MTU, 0)) > 0)
+  {
+    for(size_t offset = 0;
+        PacketView::isValid(buffer + offset, length - offset);
+        offset += PacketView(buffer + offset).getLength())
+      handle(client, PacketView(buffer + offset), now);
+  }
+}
+void Driver::handle(SimClient& client, const PacketView& packet,
+                    NetClock::time_point now)
+{
+  if(packet.isType<JoinResponse>())
+  {
+    if(client.state != SimClient::JOINING)
+      return;
+    JoinResponse response(packet);
+    if(!response.ok())
+    {
+      refused++;
+      client.state = SimClient::IDLE;
+      return;
+    }
+    client.state = SimClient::JOINED;
+    client.ID = response.assignedID();
+    client.nextAction = now;
+    client.reliable.reset(new ReliableEndpoint());
+    joinLatencies.push_back(seconds(now - client.joinSent));
+    connected.push_back(&client - clients.data());
+    joins++;
+  }
+  else if(client.state != SimClient::JOINED)
+    return;
+  else if(packet.isType<Reliable>())
+  {
+    client.reliable->receive(packet, now, unwrapped);
+    unwrapped.clear();
+    client.ackOwed = true;
+  }
+  else if(packet.isType<Snapshot>())
+  {
+    client.latest = Snapshot(packet).tick();
+    snapshots++;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  Settings settings;
+  int option;
+  while((option = getopt(argc, argv, "c:d:r:b:s:j:l:p:w:")) != -1)
+  {
+    switch(option)
+    {
+      case 'c': settings.clients = atoi(optarg); break;
+      case 'd': settings.duration = atof(optarg); break;
+      case 'r': settings.sendRate = atof(optarg); break;
+      case 'b': settings.broadcastRate = atof(optarg); break;
+      case 's': settings.snapshotSize = atoi(optarg); break;
+      case 'j': settings.joinRate = atof(optarg); break;
+      case 'l': settings.leaveRate = atof(optarg); break;
+      case 'p': settings.port = atoi(optarg); break;
+      case 'w': settings.capture = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-c clients] [-d seconds] [-r rate] "
+                "[-b broadcast rate] [-s snapshot bytes] [-j join rate] "
+                "[-l leave rate] [-p port] [-w capture]\n", argv[0]);
+        return 1;
+    }
+  }
+  if(settings.clients == 0 || settings.clients > 65534 ||
+     settings.sendRate <= 0 || settings.broadcastRate <= 0 ||
+     settings.joinRate <= 0 || settings.duration <= 0)
+  {
+    fprintf(stderr, "invalid settings\n");
+    return 1;
+  }
+  
+  // Every simulated client needs its own socket
+  struct rlimit limit;
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  
+  Server* server = new Server("bench", settings.port, settings.clients);
+  if(settings.capture)
+    server->startCapture(settings.capture);
+  ServerStats stats;
+  std::atomic<bool> stop(false);
+  Driver* driver = new Driver(settings);
+  std::thread serverThread(serve, server, &settings, &stop, &stats);
+  NetClock::time_point start = NetClock::now();
+  driver->run(start + toDuration(settings.duration));
+  
+  // Give packets in flight a moment to land
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  stop = true;
+  serverThread.join();
+  double elapsed = seconds(NetClock::now() - start);
+  
+  std::sort(driver->joinLatencies.begin(), driver->joinLatencies.end());
+  const vector<double>& latencies = driver->joinLatencies;
+  size_t lost = driver->sent > stats.received ?
+                driver->sent - stats.received : 0;
+  size_t missed = stats.recipients > driver->snapshots ?
+                  stats.recipients - driver->snapshots : 0;
+  printf("clients %u, %.1f s, %.0f packets/s each, %.0f broadcasts/s of "
+         "%zu bytes\n", settings.clients, elapsed, settings.sendRate,
+         settings.broadcastRate, settings.snapshotSize);
+  printf("joins      %zu (%zu retried, %zu refused), %zu leaves\n",
+         driver->joins, driver->retries, driver->refused, driver->leaves);
+  printf("join ms    p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+         percentile(latencies, 0.5) * 1e3, percentile(latencies, 0.9) * 1e3,
+         percentile(latencies, 0.99) * 1e3,
+         latencies.empty() ? 0.0 : latencies.back() * 1e3);
+  printf("inbound    %zu sent, %zu received (%.0f/s), %zu dropped (%.2f%%)\n",
+         driver->sent, stats.received, stats.received / elapsed, lost,
+         driver->sent ? 100.0 * lost / driver->sent : 0.0);
+  printf("outbound   %zu broadcasts, %zu expected, %zu received, %zu dropped "
+         "(%.2f%%)\n", stats.broadcasts, stats.recipients, driver->snapshots,
+         missed, stats.recipients ? 100.0 * missed / stats.recipients : 0.0);
+  printf("server cpu %.1f%% of a core (%.1f%% polling while idle); %.2f us "
+         "per packet received, %.2f us per snapshot sent\n",
+         100.0 * stats.totalCPU / elapsed, 100.0 * stats.idleCPU / elapsed,
+         stats.received ? stats.recvCPU / stats.received * 1e6 : 0.0,
+         stats.recipients ? stats.sendCPU / stats.recipients * 1e6 : 0.0);
+  if(stats.errors > 0)
+    printf("server errors %zu\n", stats.errors);
+  
+  delete driver;
+  delete server;
+  return 0;
+}
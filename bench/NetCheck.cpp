@@ -0,0 +1,131 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    NetCheck
+ * ----------------------------------------------------------------------------
+ */
+/* Loopback checks of Server's per-shard receive path. A sharded server and
+ * a Client run in one process, and the server is read one shard at a time,
+ * as an application with a thread per shard would read it. Each check
+ * prints ok or FAILED.
+ *
+ * Usage: netcheck [-p port]
+ * Exits with status 1 if any check fails.
+ */
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include "Server.h"
+#include "Client.h"
+using namespace wic;
+using std::vector;
+
+const unsigned SHARDS = 2;
+const double WAIT = 0.5;    // seconds a check waits for its packets
+const double TIMEOUT = 2.5; // seconds before a silent client is dropped
+const int ROUND_MS = 10;    // milliseconds between polls
+
+/** Reads every shard of the server once and updates both nodes.
+ *  \param type the type of packet to count
+ *  \return the number of packets of the type recieved
+ */
+size_t readShards(Server& server, Client& client, vector<PacketView>& views,
+                  uint8_t type)
+{
+  size_t found = 0;
+  for(unsigned shard = 0; shard < server.getShardCount(); shard++)
+  {
+    size_t count = server.recvBatch(views, Node::RING_SIZE, shard);
+    for(size_t i = 0; i < count; i++)
+    {
+      if(views[i].getType() == type)
+        found++;
+    }
+  }
+  server.update();
+  client.update();
+  return found;
+}
+/** Polls until the expected number of packets of a type arrive, and
+ *  reports the outcome.
+ *  \param wait the seconds to wait for them
+ *  \return true if they all arrived
+ */
+bool expect(const char* name, Server& server, Client& client,
+            uint8_t type, size_t expected, double wait)
+{
+  vector<PacketView> views;
+  size_t found = 0;
+  NetClock::time_point end = NetClock::now() +
+    std::chrono::duration_cast<NetClock::duration>(
+      std::chrono::duration<double>(wait));
+  while(NetClock::now() < end && found < expected)
+  {
+    found += readShards(server, client, views, type);
+    std::this_thread::sleep_for(std::chrono::milliseconds(ROUND_MS));
+  }
+  bool passed = found == expected;
+  printf("%-10s %zu of %zu  %s\n", name, found, expected,
+         passed ? "ok" : "FAILED");
+  return passed;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned port = 40200;
+  int option;
+  while((option = getopt(argc, argv, "p:")) != -1)
+  {
+    switch(option)
+    {
+      case 'p': port = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-p port]\n", argv[0]);
+        return 1;
+    }
+  }
+  
+  // Shard workers answer the join, so nothing need read the server yet
+  std::unique_ptr<Server> server(new Server("check", port, 8, SHARDS));
+  std::unique_ptr<Client> client(new Client("client", port, "127.0.0.1",
+                                            2.0));
+  bool passed = true;
+  
+  // Reliable packets on an ordered channel are released, not left in place
+  for(int i = 0; i < 3; i++)
+    client->sendReliable(Kick("ordered"), 0);
+  passed &= expect("ordered", *server, *client, Kick::TYPE, 3, WAIT);
+  
+  // Packets larger than a datagram are reassembled, then released
+  vector<uint8_t> blob(5000, 0xAB);
+  for(uint32_t tick = 1; tick <= 3; tick++)
+    client->send(Snapshot(tick, 0, blob.data(), blob.size()));
+  passed &= expect("fragments", *server, *client, Snapshot::TYPE, 3, WAIT);
+  
+  // A client that never updates sends no heartbeats, so it times out. The
+  // ClientLeft the server reports is released too.
+  server->setTimeout(TIMEOUT);
+  std::unique_ptr<Client> silent(new Client("silent", port, "127.0.0.1",
+                                            2.0));
+  passed &= expect("timeout", *server, *client, ClientLeft::TYPE, 1,
+                   TIMEOUT * 2.0);
+  
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    NetReplay.cpp
+ * ----------------------------------------------------------------------------
+ */
+/* Replays a capture of a server's traffic (see Node::startCapture) into a
+ * fresh Server, so that recorded traffic can be profiled offline and
+ * repeatably. The recieved datagrams of the capture are fed to
+ * Server::recvBatch through a ReplayTransport, at the recorded speed, some
+ * multiple of it, or as fast as the server takes them; whatever the server
+ * sends is discarded. netbench -w writes a suitable capture.
+ *
+ * Usage: netreplay [-x speed, 0 for as fast as possible] [-c clients]
+ *                  [-p port] capture
+ */
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <time.h>
+#include <getopt.h>
+#include "Server.h"
+using namespace wic;
+using std::vector;
+
+double threadCPU()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+void usage(const char* program)
+{
+  fprintf(stderr, "usage: %s [-x speed] [-c clients] [-p port] capture\n",
+          program);
+}
+
+int main(int argc, char** argv)
+{
+  double speed = 1.0;
+  unsigned clients = 65534;
+  unsigned port = 40101;
+  int option;
+  while((option = getopt(argc, argv, "x:c:p:")) != -1)
+  {
+    switch(option)
+    {
+      case 'x': speed = atof(optarg); break;
+      case 'c': clients = atoi(optarg); break;
+      case 'p': port = atoi(optarg); break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if(optind != argc - 1)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+  if(speed < 0 || clients == 0 || clients > 65534)
+  {
+    fprintf(stderr, "invalid settings\n");
+    return 1;
+  }
+  
+  try
+  {
+    ReplayTransport replay(argv[optind], speed);
+    Server server("replay", port, clients);
+    server.setTransport(&replay);
+    
+    // Replay until the capture runs out and the server has nothing left
+    vector<PacketView> views;
+    size_t packets = 0;
+    size_t byType[256] = {0};
+    size_t idle = 0;
+    NetClock::time_point start = NetClock::now();
+    double cpu = threadCPU();
+    while(!replay.isFinished() || idle < 2)
+    {
+      size_t count = server.recvBatch(views, Node::RING_SIZE);
+      for(size_t i = 0; i < count; i++)
+        byType[views[i].getType()]++;
+      packets += count;
+      server.update();
+      idle = count == 0 && replay.isFinished() ? idle + 1 : 0;
+      if(count == 0 && !replay.isFinished())
+        std::this_thread::yield();
+    }
+    cpu = threadCPU() - cpu;
+    double elapsed = std::chrono::duration<double>(NetClock::now() - start)
+                     .count();
+    
+    printf("replayed   %zu datagrams in %.2f s (%.0f/s), %zu sent\n",
+           replay.getReplayed(), elapsed, replay.getReplayed() / elapsed,
+           replay.getSent());
+    printf("delivered  %zu packets\n", packets);
+    for(size_t type = 0; type < 256; type++)
+    {
+      if(byType[type] > 0)
+        printf("  type %3zu %zu\n", type, byType[type]);
+    }
+    printf("server cpu %.1f%% of a core; %.2f us per datagram\n",
+           100.0 * cpu / elapsed,
+           replay.getReplayed() ? cpu / replay.getReplayed() * 1e6 : 0.0);
+  }
+  catch(const std::exception& error)
+  {
+    fprintf(stderr, "%s\n", error.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,149 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    BitStream.h
+ * ----------------------------------------------------------------------------
+ */
+/** \file */
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+#include "Bounds.h"
+#include "Error.h"
+using std::vector;
+namespace wic
+{
+  /** Packs values into as few bits as they need. Bits are written most
+   *  significant first and unused bits of the last byte are zero, so equal
+   *  values always produce identical bytes; the output can be fed straight
+   *  to DeltaCodec. Real numbers are quantized to a range and a number of
+   *  bits. A position in a 1024x1024 world with 1/8 precision, for
+   *  instance, takes 2 x 14 bits instead of the 16 bytes of a raw Pair.
+   */
+  class BitWriter
+  {
+  public:
+    /** Default constructor (empty stream). */
+    BitWriter();
+    /** Empties the stream, keeping its memory for reuse. */
+    void clear();
+    /** Writes the low bits of an integer.
+     *  \param value the integer
+     *  \param count the number of bits; must be <= 32
+     */
+    void writeBits(uint32_t value, unsigned count);
+    /** Writes a single bit. */
+    void writeBool(bool value);
+    /** Writes an integer in 8-bit groups of 7 bits each, so that small
+     *  values take a single group.
+     */
+    void writeVarint(uint64_t value);
+    /** Writes a signed integer as a varint, zig-zag encoded so that values
+     *  near zero are small.
+     */
+    void writeSignedVarint(int64_t value);
+    /** Writes a real number quantized to a range.
+     *  \param value the number; clamped to the range
+     *  \param min the lower end of the range
+     *  \param max the upper end of the range; must be > min
+     *  \param bits the number of bits; must be in the range 1-32
+     */
+    void writeFloat(double value, double min, double max, unsigned bits);
+    /** Writes a Pair quantized to a rectangle, one axis after the other.
+     *  \param value the Pair; clamped to the rectangle
+     *  \param bounds the rectangle; must have a nonzero area
+     *  \param bits the number of bits per axis; must be in the range 1-32
+     */
+    void writePair(const Pair& value, const Bounds& bounds, unsigned bits);
+    /** Writes an angle quantized to a full turn. Angles outside
+     *  [0, 2 pi) are wrapped, so no range needs to be given.
+     *  \param radians the angle
+     *  \param bits the number of bits; must be in the range 1-32
+     */
+    void writeAngle(double radians, unsigned bits);
+    /** Pads the stream with zeros to a byte boundary. */
+    void align();
+    /** Returns the bytes written. */
+    const uint8_t* getBytes() const;
+    /** Returns the number of bytes written, counting a partial last byte. */
+    size_t getLength() const;
+    /** Returns the number of bits written. */
+    size_t getBits() const;
+    /** Returns the number of bits needed to quantize a range to a
+     *  precision.
+     *  \param range the size of the range
+     *  \param precision the largest acceptable step between values
+     */
+    static unsigned bitsFor(double range, double precision);
+  private:
+    vector<uint8_t> bytes;
+    size_t bits;
+  };
+  /** Unpacks values written by a BitWriter. Values must be read with the
+   *  same types, ranges and bit counts they were written with. Reading past
+   *  the end yields zeros and marks the reader as overflowed, so malformed
+   *  packets can be detected with one check after reading.
+   */
+  class BitReader
+  {
+  public:
+    /** Constructor.
+     *  \param bytes the bytes to read
+     *  \param length the number of bytes
+     */
+    BitReader(const uint8_t* bytes, size_t length);
+    /** Reads an integer.
+     *  \param count the number of bits; must be <= 32
+     */
+    uint32_t readBits(unsigned count);
+    /** Reads a single bit. */
+    bool readBool();
+    /** Reads a varint. Varints longer than 64 bits overflow the reader. */
+    uint64_t readVarint();
+    /** Reads a zig-zag encoded varint. */
+    int64_t readSignedVarint();
+    /** Reads a quantized real number.
+     *  \param min the lower end of the range
+     *  \param max the upper end of the range; must be > min
+     *  \param bits the number of bits; must be in the range 1-32
+     */
+    double readFloat(double min, double max, unsigned bits);
+    /** Reads a quantized Pair.
+     *  \param bounds the rectangle; must have a nonzero area
+     *  \param bits the number of bits per axis; must be in the range 1-32
+     */
+    Pair readPair(const Bounds& bounds, unsigned bits);
+    /** Reads a quantized angle, in the range [0, 2 pi).
+     *  \param bits the number of bits; must be in the range 1-32
+     */
+    double readAngle(unsigned bits);
+    /** Skips to the next byte boundary. */
+    void align();
+    /** Returns the number of bits left to read. */
+    size_t getBitsLeft() const;
+    /** Returns whether or not a read went past the end. */
+    bool hasOverflowed() const;
+  private:
+    const uint8_t* bytes;
+    size_t length;  // in bits
+    size_t position;
+    bool overflowed;
+  };
+}
+#endif
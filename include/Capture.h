@@ -0,0 +1,162 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Capture.h
+ * ----------------------------------------------------------------------------
+ */
+/** \file */
+#ifndef CAPTURE_H
+#define CAPTURE_H
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "Transport.h"
+#include "Schema.h"
+#include "Error.h"
+using std::string;
+using std::vector;
+namespace wic
+{
+  /** A datagram read from a capture file. */
+  struct CaptureRecord
+  {
+    uint8_t direction;       // CaptureWriter::RECEIVED or SENT
+    double time;             // seconds since the capture began
+    struct sockaddr_in addr; // the source if recieved, else the destination
+    vector<uint8_t> data;
+  };
+  /** Writes datagrams to a capture file, a compact binary log of a node's
+   *  traffic (see Node::startCapture). The file begins with MAGIC and
+   *  VERSION. Each datagram follows as a record: its direction (U8), the
+   *  microseconds since the capture began (U64), the IPv4 address (U32) and
+   *  port (U16) of the other end, its length (U16), and its bytes. Records
+   *  may be written from several threads at once.
+   */
+  class CaptureWriter
+  {
+  public:
+    /** Constructor (creates the file, replacing any other).
+     *  \param path the path of the file
+     *  \exception Failure "capture file could not be created"
+     */
+    CaptureWriter(string path);
+    /** Destructor (closes the file). */
+    ~CaptureWriter();
+    /** Appends a datagram, stamped with the current time. Once a write has
+     *  failed, nothing more is written, so that only the last record can be
+     *  cut short.
+     *  \param direction RECEIVED or SENT
+     *  \param datagram the datagram; ignored if its length is zero
+     *  \return false if the datagram could not be written
+     */
+    bool write(uint8_t direction, const Datagram& datagram);
+    /** Returns the number of datagrams written. */
+    size_t getCount() const;
+    /** Returns whether or not a write has failed (the disk filled up, for
+     *  example).
+     */
+    bool hasFailed() const;
+    /** The direction of a datagram the node recieved. */
+    static const uint8_t RECEIVED = 0;
+    /** The direction of a datagram the node sent. */
+    static const uint8_t SENT = 1;
+    /** The first bytes of every capture file. */
+    static const uint32_t MAGIC = 0x57494343; // "WICC"
+    /** The version of the format. */
+    static const uint8_t VERSION = 1;
+    /** The bytes of a record before the datagram. */
+    static const size_t RECORD_HEADER = 17;
+  private:
+    FILE* file;
+    mutable std::mutex mutex;
+    NetClock::time_point started;
+    size_t count;
+    bool failed;
+  };
+  /** Reads the datagrams of a capture file in order. */
+  class CaptureReader
+  {
+  public:
+    /** Constructor (opens the file).
+     *  \param path the path of the file
+     *  \exception InvalidFile if the file cannot be opened or is not a
+     *             capture file
+     */
+    CaptureReader(string path);
+    /** Destructor (closes the file). */
+    ~CaptureReader();
+    /** Reads the next datagram.
+     *  \param record the destination of the datagram
+     *  \return false at the end of the file (or of its last whole record)
+     */
+    bool next(CaptureRecord& record);
+    /** Returns to the first datagram. */
+    void rewind();
+  private:
+    FILE* file;
+  };
+  /** Transport that replays the datagrams a node recieved during a capture,
+   *  so that recorded traffic can be fed to a Server offline. The recieved
+   *  datagrams are handed to recv, from their recorded addresses, when
+   *  their time comes: the replay clock starts at the first call to recv
+   *  and runs speed times faster than the recording. Sent datagrams are
+   *  counted and discarded, as are the datagrams the node sent during the
+   *  capture. A Server replays a capture faithfully if it is configured as
+   *  the captured server was and the capture began before any client
+   *  joined, since client IDs then come out the same.
+   */
+  class ReplayTransport : public Transport
+  {
+  public:
+    /** Constructor.
+     *  \param path the path of the capture file
+     *  \param speed how many times faster than recorded to replay, or zero
+     *         to replay as fast as recv is called; must be >= 0
+     *  \exception InvalidFile if the file cannot be opened or is not a
+     *             capture file
+     */
+    ReplayTransport(string path, double speed);
+    /** Returns whether or not every recieved datagram has been replayed. */
+    bool isFinished() const;
+    /** Returns the number of datagrams replayed. */
+    size_t getReplayed() const;
+    /** Returns the number of datagrams sent (and discarded). */
+    size_t getSent() const;
+    size_t recv(int fd, Datagram* const* datagrams, size_t bufferSize,
+                size_t max);
+    void send(int fd, const Datagram* datagrams, size_t count);
+  private:
+    /** Reads ahead to the next recieved datagram. */
+    void advance();
+    CaptureReader reader;
+    mutable std::mutex mutex;
+    double speed;
+    CaptureRecord pending;   // the next datagram to replay
+    bool finished;
+    bool begun;
+    NetClock::time_point started;
+    double origin;           // recorded time of the first datagram
+    size_t replayed;
+    size_t sent;
+  };
+}
+#endif
@@ -23,9 +23,17 @@
 #define CLIENT_H
 #include "Node.h"
 #include "Packet.h"
+#include "Dispatch.h"
+#include "ClockSync.h"
 namespace wic
 {
-  /** A client node that connects to a server node. */
+  /** A client node that connects to a server node.
+   *
+   *  update must be called regularly (once per frame) while joined. It
+   *  sends queued and reliable packets, and the heartbeats without which a
+   *  server that times clients out (see Server::setTimeout) drops the
+   *  client.
+   */
   class Client : public Node
   {
   public:
@@ -40,18 +48,155 @@ namespace wic
      *  \exception Failure "timeout"
      */
     Client(string name, unsigned serverPort, string serverIP, double timeout);
+    /** Constructor (does not join; see join and beginJoin).
+     *  \param name the username; limited to 20 characters
+     *  \param serverPort the server port number; must be > 1024
+     *  \param serverIP the server IP address
+     */
+    Client(string name, unsigned serverPort, string serverIP);
     ~Client();
+    /** Joins the server, sleeping until the server responds or a request
+     *  must be resent (see beginJoin).
+     *  \param timeout the time, in seconds, to wait for server response
+     *  \exception Failure "server full"
+     *  \exception Failure "banned"
+     *  \exception Failure "timeout"
+     */
+    void join(double timeout);
+    /** Starts joining the server without blocking. A join request is sent at
+     *  once and resent, at doubling intervals, until the server responds or
+     *  the timeout passes; pollJoin must be called to make progress. The
+     *  transport (see setTransport) carries the handshake, so it should be
+     *  set first. The I/O thread must not be running.
+     *  \param timeout the time, in seconds, to wait for server response;
+     *         must be > 0
+     *  \exception Error "already joined"
+     *  \exception Error "cannot join while I/O thread is running"
+     */
+    void beginJoin(double timeout);
+    /** Handles the server's response to a join started by beginJoin, if it
+     *  has arrived, and resends the request if due. Never blocks.
+     *  \return true once joined, false while still waiting
+     *  \exception Error "not joining"
+     *  \exception Failure "server full"
+     *  \exception Failure "banned"
+     *  \exception Failure "timeout"
+     */
+    bool pollJoin();
+    /** Returns whether or not a join is in progress. */
+    bool isJoining() const;
+    /** Returns whether or not the client is joined to the server. */
+    bool isJoined() const;
     /** Sends a packet to the server.
      *  \param packet the packet to send
      */
     void send(const AbstractPacket& packet) const;
+    /** Sends several packets to the server using as few system calls as
+     *  possible.
+     *  \param packets the packets to send
+     */
+    void sendBatch(const vector<const AbstractPacket*>& packets) const;
+    /** Queues a packet for the server. Queued packets are coalesced into as
+     *  few datagrams as possible (see setMTU), which are sent by update or as
+     *  soon as they fill.
+     *  \param packet the packet to queue; fragmented if larger than getMTU()
+     */
+    void queue(const AbstractPacket& packet);
+    /** Queues a packet for the server on a reliable channel. The packet is
+     *  sent by update, and sent again by later updates until the server
+     *  acknowledges it.
+     *  \param packet the packet to queue; fragmented if it does not fit
+     *         within getMTU() along with ReliableEndpoint::OVERHEAD
+     *  \param channel the channel; must be < CHANNELS
+     *  \exception Failure "reliable backlog full"
+     */
+    void sendReliable(const AbstractPacket& packet, uint8_t channel);
+    /** Limits the rate at which queued packets are sent to the server. Each
+     *  update sends the queued packets that fit within the limit in order of
+     *  priority (see setPriority); the rest are held back for later updates.
+     *  Packets sent with send, rather than queued, are not limited.
+     *  \param bytesPerSecond the limit, or zero for no limit
+     */
+    void setBandwidth(size_t bytesPerSecond);
+    /** Sends all queued packets, including reliable packets that are due to
+     *  be sent again, and a Heartbeat every second so that the server does
+     *  not time the client out (see Server::setTimeout). Also sends the
+     *  TimeRequests that keep the server's clock estimated (see
+     *  getServerTime). This should be called once per frame.
+     */
+    void update();
     /** Attempts to recieve a single packet.
      *  \param result the destination of recieved packet
      *  \return true if packet recieved, false otherwise
      */
     bool recv(MysteryPacket& result);
+    /** Attempts to recieve many packets using as few system calls as possible.
+     *  Unlike recv, packets from unknown sources are silently dropped.
+     *  \param results the destination of the recieved packets; resized to the
+     *         number of packets recieved
+     *  \param max the maximum number of datagrams to recieve; capped at
+     *         RING_SIZE. Datagrams may hold several packets.
+     *  \return the number of packets recieved
+     */
+    size_t recvBatch(vector<MysteryPacket>& results, size_t max);
+    /** Attempts to recieve many packets without copying or allocating.
+     *  Unlike recv, packets from unknown sources are silently dropped.
+     *  \param results the destination of the recieved packets; resized to the
+     *         number of packets recieved. The views are valid until the next
+     *         call to recv or recvBatch.
+     *  \param max the maximum number of datagrams to recieve; capped at
+     *         RING_SIZE. Datagrams may hold several packets.
+     *  \return the number of packets recieved
+     */
+    size_t recvBatch(vector<PacketView>& results, size_t max);
+    /** Returns whether or not the server's clock has been estimated. Once
+     *  joined, update asks for the server's time ten times a second until
+     *  it has, and every second after. Responses are consumed by recv.
+     */
+    bool isSynchronized() const;
+    /** Returns the estimated time on the server's clock, in seconds (see
+     *  Server::getTime). Every client shares this timeline, so it may be
+     *  used to schedule events and to interpolate. Small corrections to the
+     *  estimate are slewed out, so it runs smoothly, but it jumps (possibly
+     *  backwards) when found to be off by more than a quarter second, as
+     *  after the server stalls.
+     *  \exception Error "not synchronized"
+     */
+    double getServerTime() const;
+    /** Returns the estimate of the server's clock, which also reports the
+     *  round-trip time and the drift between the clocks.
+     */
+    const ClockSync& getClock() const;
   private:
+    bool process(Datagram& datagram, unsigned shard);
+    /** Delivers a packet from the server, moving it down the datagram being
+     *  rebuilt or releasing it. Fragments are reassembled.
+     */
+    void deliver(const uint8_t* bytes, bool isOrdered, Datagram& datagram,
+                 size_t& length);
+    void onClientJoined(const ClientJoined& clientJoined);
+    void onRoster(const Roster& roster);
+    void onClientInfo(const ClientInfo& clientInfo);
+    void onClientLeft(const ClientLeft& clientLeft);
+    void onKick(const Kick& kick);
+    void onBan(const Ban& ban);
+    void onShutdown(const Shutdown& shutdown);
+    /** Sends a join request and schedules the next. */
+    void requestJoin(NetClock::time_point now);
+    /** Returns a time as seconds on the client's clock. */
+    double toLocal(NetClock::time_point time) const;
     struct sockaddr_in serverAddr;
+    bool joining;
+    NetClock::time_point deadline;    // when the join times out
+    NetClock::time_point nextRequest; // when the join request is resent
+    double retryInterval;             // seconds until the next resend
+    NetClock::time_point nextHeartbeat;
+    NetClock::time_point epoch;       // start of the client's clock
+    NetClock::time_point nextSync;    // when a TimeRequest is next sent
+    ClockSync clock;
+    vector<PacketView> views;
+    vector<uint8_t> unwrapped;
+    Dispatcher roster; // applies packets from the server to the roster
   };
 }
 #endif
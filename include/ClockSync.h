@@ -0,0 +1,102 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    ClockSync.h
+ * ----------------------------------------------------------------------------
+ */
+/** \file */
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+#include <stddef.h>
+#include <cmath>
+#include <algorithm>
+#include "Error.h"
+namespace wic
+{
+  /** An estimate of a remote clock built from round trips, as in NTP. Each
+   *  round trip yields a sample: the round-trip time, less the time the
+   *  remote end held the request, and an offset that assumes the two legs
+   *  of the trip took equally long. Only
+   *  the samples whose round-trip times are close to the smallest of the
+   *  last SAMPLES are trusted, since queueing delay is what makes the legs
+   *  unequal. A line fitted through the trusted samples gives the offset and
+   *  its drift. When a new estimate disagrees slightly with the old one, the
+   *  difference is slewed out gradually, so the estimated remote time
+   *  neither jumps nor runs backwards. Differences larger than a quarter
+   *  second are stepped at once, so the estimate may then jump either way.
+   *  Times are in seconds, and local times may count from any origin.
+   */
+  class ClockSync
+  {
+  public:
+    /** Constructor. */
+    ClockSync();
+    /** Forgets all samples, as if newly constructed. */
+    void reset();
+    /** Adds the sample of a round trip.
+     *  \param sent the local time the request was sent
+     *  \param remoteReceived the remote time the request arrived
+     *  \param remoteSent the remote time the request was answered
+     *  \param received the local time the response arrived
+     *  \return false if the sample was rejected (it arrived before it was
+     *          sent, or took longer than MAX_RTT)
+     */
+    bool addSample(double sent, double remoteReceived, double remoteSent,
+                   double received);
+    /** Returns whether or not enough samples (MIN_SAMPLES) have been added
+     *  for an estimate.
+     */
+    bool isSynchronized() const;
+    /** Returns the estimated remote time.
+     *  \param local the local time
+     *  \exception Error "not synchronized"
+     */
+    double getRemoteTime(double local) const;
+    /** Returns the smallest round-trip time among the recent samples. */
+    double getRTT() const;
+    /** Returns the estimated drift: the seconds the remote clock gains on
+     *  the local clock every second.
+     */
+    double getDrift() const;
+    /** The number of recent samples kept. */
+    static const size_t SAMPLES = 16;
+    /** The number of samples needed for an estimate. */
+    static const size_t MIN_SAMPLES = 4;
+    /** The longest round trip accepted, in seconds. */
+    static const double MAX_RTT;
+  private:
+    /** A round trip. */
+    struct Sample
+    {
+      double local;  // midpoint of the trip
+      double offset; // remote time minus local time
+      double rtt;
+    };
+    double estimate(double local) const;
+    double remaining(double local) const;
+    Sample samples[SAMPLES]; // a ring
+    size_t next;
+    size_t count;
+    double rtt;
+    double anchor;           // local time the fitted line is centred on
+    double offset;           // fitted offset at anchor
+    double drift;            // slope of the fitted line
+    double correction;       // difference being slewed out
+    double corrected;        // local time the correction was made
+  };
+}
+#endif
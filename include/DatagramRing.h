@@ -0,0 +1,89 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    DatagramRing.h
+ * ----------------------------------------------------------------------------
+ */
+/** \file */
+#ifndef DATAGRAMRING_H
+#define DATAGRAMRING_H
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <netinet/in.h>
+using std::vector;
+using std::atomic;
+namespace wic
+{
+  /** A datagram buffer along with its length and remote address. */
+  struct Datagram
+  {
+    uint8_t* data;            /**< the datagram bytes */
+    size_t length;            /**< the number of bytes used */
+    struct sockaddr_in addr;  /**< the source or destination address */
+    std::chrono::steady_clock::time_point time; /**< when recieved */
+  };
+  /** A ring of fixed-size datagram slots. Slots are allocated once, up front,
+   *  so datagrams can be written straight into the ring by the socket and
+   *  read back in place. The producer fills slots past the back of the ring
+   *  and pushes them; the consumer reads slots from the front and pops them.
+   *  The ring is lock-free and safe for one producer thread and one consumer
+   *  thread.
+   */
+  class DatagramRing
+  {
+  public:
+    /** Constructor.
+     *  \param capacity the number of slots; must be a power of two
+     *  \param slotSize the size of each slot in bytes
+     */
+    DatagramRing(size_t capacity, size_t slotSize);
+    /** Returns the number of slots. */
+    size_t getCapacity() const;
+    /** Returns the size of each slot in bytes. */
+    size_t getSlotSize() const;
+    /** Returns the number of pushed slots that have not been popped. */
+    size_t size() const;
+    /** Returns the number of slots available to the producer. */
+    size_t space() const;
+    /** Returns a slot past the back of the ring (producer side).
+     *  \param i the offset from the back; must be < space()
+     */
+    Datagram& back(size_t i);
+    /** Makes slots at the back of the ring available to the consumer.
+     *  \param n the number of slots; must be <= space()
+     */
+    void push(size_t n);
+    /** Returns a slot from the front of the ring (consumer side).
+     *  \param i the offset from the front; must be < size()
+     */
+    Datagram& front(size_t i);
+    /** Returns slots at the front of the ring to the producer.
+     *  \param n the number of slots; must be <= size()
+     */
+    void pop(size_t n);
+  private:
+    vector<uint8_t> storage;
+    vector<Datagram> slots;
+    size_t slotSize;
+    size_t mask;
+    atomic<size_t> head;
+    atomic<size_t> tail;
+  };
+}
+#endif
@@ -0,0 +1,138 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Dispatch.h
+ * ----------------------------------------------------------------------------
+ */
+/** \file */
+#ifndef DISPATCH_H
+#define DISPATCH_H
+#include <vector>
+#include <stdint.h>
+#include "Packet.h"
+using std::vector;
+namespace wic
+{
+  /** Calls a handler for each packet according to its type. Handlers are
+   *  kept in a table indexed by the TYPE byte, so dispatching a packet is a
+   *  single lookup and an indirect call. The handler recieves a concrete
+   *  packet wrapping the recieved bytes, so nothing is copied. Packets too
+   *  short to hold their type's fields are ignored.
+   */
+  class Dispatcher
+  {
+  public:
+    /** Constructor (no handlers). */
+    Dispatcher();
+    /** Sets the handler of a packet type, replacing any other.
+     *  \param handler the function to call with each packet of the type
+     *  \param context passed to the handler unchanged
+     */
+    template <class PacketClass>
+    void setHandler(void (*handler)(const PacketClass&, void*),
+                    void* context)
+    {
+      Entry& entry = entries[PacketClass::TYPE];
+      entry.call = &callFunction<PacketClass>;
+      entry.function = (Function) handler;
+      entry.context = context;
+    }
+    /** Sets a member function as the handler of a packet type, replacing any
+     *  other. The member function is bound at compile time, for example
+     *  setHandler<Kick, Game, &Game::onKick>(game).
+     *  \param object the object whose member function is called
+     */
+    template <class PacketClass, class Object,
+              void (Object::*Method)(const PacketClass&)>
+    void setHandler(Object* object)
+    {
+      Entry& entry = entries[PacketClass::TYPE];
+      entry.call = &callMethod<PacketClass, Object, Method>;
+      entry.function = nullptr;
+      entry.context = object;
+    }
+    /** Sets the handler of packets of types without their own handler.
+     *  \param handler the function to call with each such packet, or
+     *         nullptr to ignore them
+     *  \param context passed to the handler unchanged
+     */
+    void setDefaultHandler(void (*handler)(const PacketView&, void*),
+                           void* context);
+    /** Removes the handler of a packet type.
+     *  \param type the packet type (the TYPE of a packet class)
+     */
+    void removeHandler(uint8_t type);
+    /** Returns whether or not a packet type has its own handler. */
+    bool hasHandler(uint8_t type) const;
+    /** Calls the handler of a packet.
+     *  \param packet the packet
+     *  \return false if the packet was ignored
+     */
+    bool dispatch(const PacketView& packet) const
+    {
+      const Entry& entry = entries[packet.getType()];
+      if(entry.call)
+        return entry.call(entry.function, packet, entry.context);
+      if(fallback)
+      {
+        fallback(packet, fallbackContext);
+        return true;
+      }
+      return false;
+    }
+    /** Calls the handler of each of several packets, in order.
+     *  \param packets the packets
+     *  \return the number of packets not ignored
+     */
+    size_t dispatch(const vector<PacketView>& packets) const;
+  private:
+    typedef void (*Function)();
+    typedef bool (*Call)(Function function, const PacketView& packet,
+                         void* context);
+    /** The handler of one packet type. */
+    struct Entry
+    {
+      Entry();
+      Call call;         // adapts the packet to the handler; null if none
+      Function function; // the handler, if a function
+      void* context;
+    };
+    template <class PacketClass>
+    static bool callFunction(Function function, const PacketView& packet,
+                             void* context)
+    {
+      if(packet.getSize() < PacketClass::SIZE)
+        return false;
+      ((void (*)(const PacketClass&, void*)) function)(PacketClass(packet),
+                                                      context);
+      return true;
+    }
+    template <class PacketClass, class Object,
+              void (Object::*Method)(const PacketClass&)>
+    static bool callMethod(Function, const PacketView& packet, void* context)
+    {
+      if(packet.getSize() < PacketClass::SIZE)
+        return false;
+      (static_cast<Object*>(context)->*Method)(PacketClass(packet));
+      return true;
+    }
+    Entry entries[256];
+    void (*fallback)(const PacketView&, void*);
+    void* fallbackContext;
+  };
+}
+#endif
@@ -0,0 +1,79 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Interest.h
+ * ----------------------------------------------------------------------------
+ */
+/** \file */
+#ifndef INTEREST_H
+#define INTEREST_H
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "Bounds.h"
+#include "Error.h"
+using std::vector;
+namespace wic
+{
+  /** A spatial index of the regions clients are interested in. The world is
+   *  divided into square cells, and each view is recorded in the cells it
+   *  overlaps, so finding the views that contain a position only examines
+   *  the views sharing its cell. Views spanning more than MAX_CELLS cells are
+   *  kept aside and examined for every position instead.
+   */
+  class InterestGrid
+  {
+  public:
+    /** Constructor.
+     *  \param cellSize the side length of a cell; must be > 0
+     */
+    InterestGrid(double cellSize);
+    /** Sets a client's view, replacing any previous one.
+     *  \param ID the client's ID
+     *  \param view the region the client is interested in
+     */
+    void setView(uint16_t ID, const Bounds& view);
+    /** Removes a client's view, if any. */
+    void removeView(uint16_t ID);
+    /** Returns whether or not a client has a view. */
+    bool hasView(uint16_t ID) const;
+    /** Finds the clients whose views contain a position.
+     *  \param position the position
+     *  \param results the destination of the IDs; cleared first
+     */
+    void query(const Pair& position, vector<uint16_t>& results) const;
+    /** Changes the cell size, reindexing every view.
+     *  \param cellSize the side length of a cell; must be > 0
+     */
+    void setCellSize(double cellSize);
+    /** Returns the cell size. */
+    double getCellSize() const;
+    /** The most cells a view is recorded in. */
+    static const size_t MAX_CELLS = 4096;
+  private:
+    int64_t cellOf(double coordinate) const;
+    static uint64_t key(int64_t x, int64_t y);
+    void index(uint16_t ID);
+    void unindex(uint16_t ID);
+    double cellSize;
+    std::unordered_map<uint64_t, vector<uint16_t>> cells;
+    vector<uint16_t> wide;  // views spanning too many cells
+    vector<Bounds> views;
+    vector<bool> viewing;
+  };
+}
+#endif
@@ -0,0 +1,173 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Interpolation.h
+ * ----------------------------------------------------------------------------
+ */
+/** \file */
+#ifndef INTERPOLATION_H
+#define INTERPOLATION_H
+#include <deque>
+#include <algorithm>
+#include <stddef.h>
+#include "Error.h"
+namespace wic
+{
+  /** Buffers timestamped states of a remote entity and interpolates between
+   *  them, so that the entity moves smoothly however unevenly its states
+   *  arrive. States are stamped with the server's clock (see
+   *  Client::getServerTime) and rendered a fixed delay in the past, which
+   *  leaves time for the next state to arrive; the delay should cover a
+   *  couple of server ticks plus the jitter of the connection. When the
+   *  next state is late anyway, the last two are extrapolated for a
+   *  limited time before the entity is held in place. The interpolation
+   *  function is bound at compile time, for example
+   *  InterpolationBuffer<Pair, &lerpPair>, where lerpPair returns the state
+   *  a fraction of the way from one state to another. Fractions above one
+   *  extrapolate.
+   */
+  template <class State,
+            State (*Interpolate)(const State&, const State&, double)>
+  class InterpolationBuffer
+  {
+  public:
+    /** Constructor.
+     *  \param delay how far in the past, in seconds, states are rendered;
+     *         must be >= 0
+     *  \param capacity the most states kept; must be >= 2
+     */
+    InterpolationBuffer(double delay, size_t capacity)
+    : delay(0.0), extrapolation(0.0), capacity(capacity)
+    {
+      if(capacity < 2)
+        throw InvalidArgument("capacity", "< 2");
+      setDelay(delay);
+    }
+    /** Adds a state. States may arrive out of order; a state older than
+     *  every kept state is dropped once the buffer is full, and a state
+     *  with the same time as a kept state replaces it.
+     *  \param time the server time of the state
+     *  \param state the state
+     */
+    void push(double time, const State& state)
+    {
+      size_t index = entries.size();
+      while(index > 0 && entries[index - 1].time >= time)
+        index--;
+      if(index < entries.size() && entries[index].time == time)
+      {
+        entries[index].state = state;
+        return;
+      }
+      if(entries.size() == capacity)
+      {
+        if(index == 0)
+          return;
+        entries.pop_front();
+        index--;
+      }
+      Entry entry;
+      entry.time = time;
+      entry.state = state;
+      entries.insert(entries.begin() + index, entry);
+    }
+    /** Samples the entity as it was delay seconds before a server time.
+     *  \param now the server time
+     *  \param result the destination of the state
+     *  \return false if no state has been pushed
+     */
+    bool sample(double now, State& result) const
+    {
+      if(entries.empty())
+        return false;
+      double time = now - delay;
+      if(entries.size() == 1 || time <= entries.front().time)
+      {
+        result = entries.front().state;
+        return true;
+      }
+      
+      // Find the states on either side, or extrapolate past the newest
+      size_t next = 1;
+      while(next < entries.size() - 1 && entries[next].time < time)
+        next++;
+      const Entry& from = entries[next - 1];
+      const Entry& to = entries[next];
+      if(time > to.time)
+        time = std::min(time, to.time + extrapolation);
+      result = Interpolate(from.state, to.state,
+                           (time - from.time) / (to.time - from.time));
+      return true;
+    }
+    /** Sets how far in the past states are rendered.
+     *  \param delay the delay in seconds; must be >= 0
+     */
+    void setDelay(double delay)
+    {
+      if(!(delay >= 0.0))
+        throw InvalidArgument("delay", "< 0");
+      this->delay = delay;
+    }
+    /** Returns how far in the past, in seconds, states are rendered. */
+    double getDelay() const
+    {
+      return delay;
+    }
+    /** Sets how long the newest states are extrapolated once the next is
+     *  late (zero by default, which holds the newest state).
+     *  \param seconds the limit; must be >= 0
+     */
+    void setExtrapolation(double seconds)
+    {
+      if(!(seconds >= 0.0))
+        throw InvalidArgument("seconds", "< 0");
+      extrapolation = seconds;
+    }
+    /** Returns how long the newest states are extrapolated. */
+    double getExtrapolation() const
+    {
+      return extrapolation;
+    }
+    /** Returns the number of states kept. */
+    size_t getSize() const
+    {
+      return entries.size();
+    }
+    /** Returns the server time of the newest state, or zero if none. */
+    double getNewest() const
+    {
+      return entries.empty() ? 0.0 : entries.back().time;
+    }
+    /** Forgets every state. */
+    void clear()
+    {
+      entries.clear();
+    }
+  private:
+    /** A timestamped state. */
+    struct Entry
+    {
+      double time;
+      State state;
+    };
+    std::deque<Entry> entries; // oldest first
+    double delay;
+    double extrapolation;
+    size_t capacity;
+  };
+}
+#endif
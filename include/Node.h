@@ -22,6 +22,11 @@
 #ifndef NODE_H
 #define NODE_H
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <algorithm>
 #include <time.h>
 #include <stdint.h>
 #include <arpa/inet.h>
@@ -32,15 +37,34 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <errno.h>
+#include <poll.h>
 #include <unistd.h>
 #include "Error.h"
+#include "DatagramRing.h"
+#include "Reliable.h"
+#include "Reassembler.h"
+#include "Transport.h"
+#include "Capture.h"
 using std::string;
 using std::vector;
 namespace wic
 {
   /** A node ID. */
-  typedef uint8_t NodeID;
-  /** A UDP node. Each node possesses a name and a unique integer ID. */
+  typedef uint16_t NodeID;
+  class PacketView;
+  class MysteryPacket;
+  class AbstractPacket;
+  /** A UDP node. Each node possesses a name and a unique integer ID.
+   *
+   *  Nodes share no buffers, so separate nodes may be used from separate
+   *  threads freely. Within one node, the immediate sends (send and sendBatch
+   *  of Client and Server) serialize into space belonging to the calling
+   *  thread, so they may be called from several threads at once and while
+   *  another thread recieves. Everything else (recieving, queueing, the
+   *  reliable channels, update, and configuration) must be called from one
+   *  thread at a time unless a subclass says otherwise. Views returned by
+   *  recvBatch belong to the node and are valid until its next recieve.
+   */
   class Node
   {
   public:
@@ -54,6 +78,43 @@ namespace wic
      *  \param name name of the node; limited to 20 characters
      */
     Node(string name);
+    /** Destructor (stops the I/O thread, if running). */
+    virtual ~Node();
+    /** Starts a dedicated I/O thread. While running, the thread continuously
+     *  drains the socket into the receive ring and transmits queued outbound
+     *  datagrams, so packets are no longer left waiting in the kernel between
+     *  frames. recv and send only touch the rings. Datagrams are dropped if
+     *  either ring fills.
+     */
+    void startIOThread();
+    /** Stops the I/O thread, transmitting any queued datagrams first. */
+    void stopIOThread();
+    /** Sets the transport that moves datagrams to and from the socket, for
+     *  example an ImpairedTransport to test under poor network conditions.
+     *  The transport must outlive the node (or be replaced first).
+     *  \param transport the transport, or nullptr for the kernel's sockets
+     *  \exception Error "cannot change transport while I/O thread is
+     *              running"
+     */
+    void setTransport(Transport* transport);
+    /** Returns whether or not the I/O thread is running. */
+    bool hasIOThread() const;
+    /** Starts writing every datagram the node sends and recieves to a
+     *  capture file (see CaptureWriter), replacing any capture in progress.
+     *  Datagrams are captured where they meet the transport, along with the
+     *  time and the address of the other end, so a capture of a server can
+     *  be replayed into another (see ReplayTransport). Capturing may start
+     *  and stop at any time, from any thread.
+     *  \param path the path of the capture file
+     *  \exception Failure "capture file could not be created"
+     */
+    void startCapture(string path);
+    /** Stops capturing, closing the capture file. */
+    void stopCapture();
+    /** Returns whether or not the node is capturing. Capturing ends on its
+     *  own if the capture file cannot be written.
+     */
+    bool isCapturing() const;
     /** Returns the unique ID. */
     NodeID getID() const;
     /** Returns the name. */
@@ -61,13 +122,280 @@ namespace wic
     /** Returns the maximum allowed ID. */
     NodeID getMaxID() const;
     /** Returns the maximum number of connected nodes. */
-    uint8_t getMaxNodes() const;
+    unsigned getMaxNodes() const;
     /** Returns whether or not an ID is in use */
     bool isUsed(NodeID ID) const;
     /** Returns the name currently or previously associated with an ID. */
     string getNodeName(NodeID ID) const;
+    /** Sets the size of the largest datagram sent. Queued packets are
+     *  packed back to back, each with its own header, until the next would
+     *  overflow this size. Packets larger than this size are split into
+     *  Fragment packets and reassembled by the recipient, which recieves
+     *  them after the datagrams of the recv or recvBatch call that completed
+     *  them (from shard 0, on a server read one shard at a time).
+     *  Reliable packets are cut to size when queued, so the size may not
+     *  drop below a reliable packet still waiting to be acknowledged.
+     *  \param mtu the size in bytes; must be in the range 64-MTU
+     *  \exception InvalidArgument "mtu" "< a reliable packet in flight"
+     */
+    void setMTU(size_t mtu);
+    /** Returns the size of the largest datagram sent. */
+    size_t getMTU() const;
+    /** Limits the memory held by partially reassembled packets and how long
+     *  they are kept (4 MiB and 5 seconds by default). When a new packet
+     *  would exceed the limit, the oldest partial packets are dropped.
+     *  \param maxBytes the most memory held by partial packets
+     *  \param timeout the time, in seconds, to wait for the rest of a packet;
+     *         must be > 0
+     */
+    void setReassemblyLimits(size_t maxBytes, double timeout);
+    /** Sets the priority of a packet type. When a destination's bandwidth is
+     *  limited, queued packets are sent in order of priority. A packet's
+     *  priority grows by its type's priority every update it is held back,
+     *  so low-priority packets are delayed rather than starved. Every type
+     *  has a priority of 1 by default.
+     *  \param type the packet type (the TYPE of a packet class)
+     *  \param priority the priority; must be > 0
+     */
+    void setPriority(uint8_t type, float priority);
+    /** Returns the priority of a packet type. */
+    float getPriority(uint8_t type) const;
+    /** Sets whether or not packets sent over a reliable channel are
+     *  delivered in the order they were sent. Channels other than 0 are
+     *  unordered by default.
+     *  \param channel the channel; must be in the range 1-(CHANNELS-1)
+     *  \param ordered whether or not the channel is ordered
+     */
+    void setOrdered(uint8_t channel, bool ordered);
+    /** Returns whether or not a reliable channel is ordered.
+     *  \param channel the channel; must be < CHANNELS
+     */
+    bool isOrdered(uint8_t channel) const;
+    /** The number of reliable channels. Channel 0 is always ordered and also
+     *  carries the server's roster packets.
+     */
+    static const uint8_t CHANNELS = ReliableEndpoint::CHANNELS;
+    /** The maximum number of datagrams moved by a single batched system
+     *  call.
+     */
+    static const size_t BATCH_SIZE = Transport::BATCH_SIZE;
+    /** The number of slots in the receive ring. This is the most packets
+     *  that can be recieved by a single call to recvBatch.
+     */
+    static const size_t RING_SIZE = 256;
+    /** The most bytes of queued packets held back for a destination whose
+     *  bandwidth is limited. Beyond this, the lowest-priority packets are
+     *  dropped.
+     */
+    static const size_t MAX_DEFERRED = 65536;
+    /** The largest datagram sent or recieved, in bytes. This is the path MTU
+     *  of a standard 1500-byte Ethernet link less the IPv4 and UDP headers,
+     *  so datagrams of this size are never fragmented by IP.
+     */
+    static const size_t MTU = 1472;
   protected:
-    void bindSocket(unsigned socketPort);
+    /** Constructor (binds socket to port). The other constructors delegate
+     *  to this one.
+     *  \param name name of the node; limited to 20 characters
+     *  \param socketPort the port on which to bind the socket (see
+     *         checkPort), or zero for any port
+     *  \param reusePort whether or not other sockets may bind the same port
+     *         (SO_REUSEPORT)
+     *  \exception Failure "port already in use"
+     */
+    Node(string name, unsigned socketPort, bool reusePort);
+    /** Returns a port after checking that it may be bound.
+     *  \param socketPort the port; must be > 1024
+     */
+    static unsigned checkPort(unsigned socketPort);
+    void bindSocket(unsigned socketPort, bool reusePort);
+    /** Opens a non-blocking UDP socket bound to a port.
+     *  \param socketPort the port, or zero for any port
+     *  \param reusePort whether or not to set SO_REUSEPORT before binding
+     *  \return the socket
+     *  \exception Failure "port already in use"
+     */
+    int openSocket(unsigned socketPort, bool reusePort);
+    /** Receives as many as max datagrams through the transport, stamping
+     *  each with the time it was received.
+     *  \param fd the socket to read
+     *  \param datagrams max destination datagrams; lengths of zero mark
+     *         datagrams that should be ignored
+     *  \param bufferSize the size of each datagram's buffer
+     *  \param max the maximum number of datagrams to receive; must be <=
+     *         BATCH_SIZE
+     *  \return the number of datagrams received
+     */
+    size_t recvDatagrams(int fd, Datagram* const* datagrams,
+                         size_t bufferSize, size_t max);
+    /** Sends datagrams using as few system calls as possible (sendmmsg where
+     *  available). Datagrams that cannot be sent are dropped. Datagrams may
+     *  share buffers.
+     *  \param datagrams the datagrams
+     *  \param count the number of datagrams
+     */
+    void sendDatagrams(const Datagram* datagrams, size_t count) const;
+    /** Sends a single datagram.
+     *  \param data the datagram bytes
+     *  \param length the datagram length
+     *  \param destAddr the destination
+     */
+    void sendDatagram(uint8_t* data, size_t length,
+                      const struct sockaddr_in& destAddr) const;
+    /** Releases the slots handed out by the previous call, then makes up to
+     *  max datagrams available at the front of the receive ring.
+     *  \param max the maximum number of datagrams to recieve
+     *  \return the number of datagrams available
+     */
+    size_t receive(size_t max);
+    /** Filters a recieved datagram in place, leaving only the packets that
+     *  should be delivered, back to back.
+     *  \param datagram the datagram; its length is updated
+     *  \param shard the shard that recieved the datagram
+     *  \return false if the datagram came from an unknown source
+     */
+    virtual bool process(Datagram& datagram, unsigned shard) = 0;
+    /** Makes the next processed datagram available for reading.
+     *  \param unknown set to true if a datagram from an unknown source was
+     *         dropped
+     *  \return the datagram, or nullptr if none is available
+     */
+    virtual Datagram* nextDatagram(bool& unknown);
+    /** Recieves up to max datagrams and unpacks them into views.
+     *  \param results the destination views; not resized
+     *  \param max the maximum number of datagrams to recieve
+     *  \return the number of views written
+     */
+    virtual size_t gather(vector<PacketView>& results, size_t max);
+    /** Recieves a single packet, unpacking coalesced datagrams one packet at
+     *  a time.
+     *  \param result the destination of the recieved packet
+     *  \param unknown set to true if a datagram from an unknown source was
+     *         dropped
+     *  \return true if packet recieved, false otherwise
+     */
+    bool recvPacket(MysteryPacket& result, bool& unknown);
+    /** Recieves the packets of up to max datagrams as views. Packets left
+     *  over in a datagram partially read by recvPacket are returned first,
+     *  on their own.
+     *  \param results the destination views; resized to the number of
+     *         packets recieved
+     *  \param max the maximum number of datagrams to recieve
+     *  \return the number of packets recieved
+     */
+    size_t recvViews(vector<PacketView>& results, size_t max);
+    /** Appends views of the packets in a processed datagram.
+     *  \param datagram the datagram
+     *  \param offset the offset of the first packet to append
+     *  \param results the destination views
+     *  \param count the number of views already in results
+     *  \return the new number of views in results
+     */
+    size_t unpack(const Datagram& datagram, size_t offset,
+                  vector<PacketView>& results, size_t count) const;
+    /** Appends views of the packets released since the last call (see
+     *  release). The views are valid until the next call.
+     *  \param results the destination views
+     *  \param count the number of views already in results
+     *  \return the new number of views in results
+     */
+    size_t unpackReleased(vector<PacketView>& results, size_t count);
+    /** Appends serialized packets to the datagram being assembled for a
+     *  destination, first transmitting that datagram if they would not fit.
+     *  \param bytes the serialized packets
+     *  \param length the number of bytes; must be <= getMTU()
+     *  \param slot an index identifying the destination
+     *  \param destAddr the destination
+     */
+    void coalesce(const uint8_t* bytes, size_t length, size_t slot,
+                  const struct sockaddr_in& destAddr);
+    /** Transmits the datagram being assembled for a destination, if any. */
+    void flush(size_t slot);
+    /** Transmits reliable envelopes and acknowledgements that are due, then
+     *  the held back packets that fit within each destination's bandwidth,
+     *  then every datagram being assembled.
+     */
+    void flushAll();
+    /** Limits the rate at which queued packets are sent to a destination.
+     *  Queued packets beyond the limit are held back for later updates and
+     *  sent in order of priority (see setPriority). Reliable traffic is
+     *  never held back, but counts against the limit.
+     *  \param slot an index identifying the destination
+     *  \param bytesPerSecond the limit, or zero for no limit
+     */
+    void setBudget(size_t slot, size_t bytesPerSecond);
+    /** Serializes a packet into pieces, splitting it into Fragment packets
+     *  if it does not fit within a limit.
+     *  \param packet the packet
+     *  \param source the desired source of the packet
+     *  \param limit the largest piece, in bytes
+     *  \return the number of serialized packets written to pieces, back to
+     *          back
+     */
+    size_t fragment(const AbstractPacket& packet, NodeID source,
+                    size_t limit) const;
+    /** Immediately sends pieces to a destination, one per datagram.
+     *  \param count the number of pieces
+     *  \param destAddr the destination
+     */
+    void sendPieces(size_t count, const struct sockaddr_in& destAddr) const;
+    /** Coalesces pieces into the datagram being assembled for a destination,
+     *  or holds them back for a later update if the destination's bandwidth
+     *  is limited.
+     *  \param count the number of pieces
+     *  \param slot an index identifying the destination
+     *  \param destAddr the destination
+     */
+    void queuePieces(size_t count, size_t slot,
+                     const struct sockaddr_in& destAddr);
+    /** Queues a packet on a reliable channel to a destination. Packets that
+     *  do not fit within getMTU() along with ReliableEndpoint::OVERHEAD are
+     *  fragmented, each piece being sent reliably.
+     *  \param packet the packet
+     *  \param source the desired source of the packet
+     *  \param channel the channel; must be < CHANNELS
+     *  \param slot an index identifying the destination
+     *  \param destAddr the destination
+     *  \exception Failure "reliable backlog full"
+     */
+    void enqueueReliable(const AbstractPacket& packet, NodeID source,
+                         uint8_t channel, size_t slot,
+                         const struct sockaddr_in& destAddr);
+    /** Immediately coalesces and transmits whatever is due on a
+     *  destination's reliable channels.
+     */
+    void transmitReliable(size_t slot);
+    /** Handles a recieved Reliable envelope.
+     *  \param envelope the envelope
+     *  \param slot an index identifying the sender
+     *  \param srcAddr the sender's address
+     *  \param out the destination of the serialized packets that may now be
+     *         delivered; cleared first
+     *  \return true if the packets belong to an ordered channel, in which
+     *          case they should be passed to release
+     */
+    bool unwrap(const PacketView& envelope, size_t slot,
+                const struct sockaddr_in& srcAddr, vector<uint8_t>& out);
+    /** Handles a recieved Ack packet.
+     *  \param ack the packet
+     *  \param slot an index identifying the sender
+     */
+    void acknowledge(const PacketView& ack, size_t slot);
+    /** Handles a recieved Fragment packet.
+     *  \param fragment the packet
+     *  \param slot an index identifying the sender
+     *  \return the serialized packet if the fragment completed it, otherwise
+     *          nullptr. The packet is valid until the next call.
+     */
+    const vector<uint8_t>* reassemble(const PacketView& fragment, size_t slot);
+    /** Discards everything queued for a destination, its reliable channel
+     *  state, and its partially reassembled packets.
+     */
+    void resetPeer(size_t slot);
+    /** Queues serialized packets for delivery after those in the datagrams
+     *  recieved by the current recv call. Safe to call from any thread.
+     */
+    void release(const uint8_t* bytes, size_t length);
     static const uint8_t MAX_NAME_LEN;
     bool joined;
     NodeID ID;
@@ -78,6 +406,69 @@ namespace wic
     int sock;
     socklen_t lenAddr;
     struct sockaddr_in addr;
+    DatagramRing recvRing;
+    size_t held;
+    static thread_local vector<uint8_t> pieces; // written by fragment
+  private:
+    /** Queued packets held back by a bandwidth limit. */
+    struct Deferred
+    {
+      size_t offset;   // into Peer::deferredData
+      size_t length;
+      float priority;  // accumulated
+      float increment; // the priority of the packet type
+    };
+    /** Outbound state for one destination. */
+    struct Peer
+    {
+      Peer();
+      vector<uint8_t> data;    // datagram being assembled
+      struct sockaddr_in addr;
+      bool listed;             // whether or not the peer is in dirty
+      std::unique_ptr<ReliableEndpoint> reliable; // created on first use
+      bool linked;             // whether or not the peer is in linkedPeers
+      size_t budget;           // bytes per second, zero if unlimited
+      double tokens;           // bytes that may be sent now
+      NetClock::time_point refilled;
+      vector<Deferred> deferred;
+      vector<uint8_t> deferredData;
+      bool throttled;          // whether or not the peer is in throttled
+    };
+    Peer& getPeer(size_t slot);
+    void link(size_t slot);
+    void refill(Peer& peer, NetClock::time_point now);
+    void schedule(size_t slot, NetClock::time_point now);
+    bool takeReleased();
+    void transmit(const Datagram* datagrams, size_t count) const;
+    void ioLoop();
+    mutable DatagramRing sendRing;
+    mutable std::mutex sendMutex; // serializes producers of sendRing
+    std::thread ioThread;
+    atomic<bool> running;
+    atomic<bool> threaded;
+    const Datagram* partial; // datagram being read one packet at a time
+    size_t cursor;
+    vector<Peer> peers;
+    vector<size_t> dirty;       // peers that may hold queued packets
+    vector<size_t> linkedPeers; // peers with reliable traffic outstanding
+    vector<size_t> throttled;   // peers holding back queued packets
+    vector<size_t> order;       // deferred packets by priority
+    vector<uint8_t> keptData;   // deferred packets still held back
+    size_t mtu;
+    bool ordered[CHANNELS];
+    std::mutex releasedMutex;
+    vector<uint8_t> released;   // filled by process
+    vector<uint8_t> delivering; // released packets being read
+    Datagram deliveringDatagram;
+    static thread_local vector<uint8_t> whole; // packet being fragmented
+    static thread_local uint8_t piecesType;    // type of the packet in pieces
+    mutable atomic<uint16_t> nextMessage; // ID of the next fragmented packet
+    float priorities[256];
+    Reassembler reassembler;
+    SocketTransport socketTransport;
+    Transport* transport;
+    atomic<bool> capturing;
+    std::shared_ptr<CaptureWriter> capture; // loaded and stored atomically
   };
 }
 #endif
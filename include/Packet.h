@@ -22,10 +22,53 @@
 #ifndef PACKET_H
 #define PACKET_H
 #include "Node.h"
+#include "Schema.h"
 using std::string;
 using std::vector;
 namespace wic
 {
+  /** Read-only view of a recieved packet. A view points straight into the
+   *  receive ring of the node that recieved it, so creating one costs no
+   *  allocation or copying. A view is only valid until the next call to recv
+   *  or recvBatch on that node.
+   */
+  class PacketView
+  {
+  public:
+    /** Default constructor (empty view). */
+    PacketView();
+    /** Constructor.
+     *  \param datagram a network buffer holding a complete packet
+     */
+    PacketView(const uint8_t* datagram);
+    /** Returns whether or not a network buffer holds a complete packet.
+     *  \param datagram a network buffer
+     *  \param length the number of bytes in the buffer
+     */
+    static bool isValid(const uint8_t* datagram, size_t length);
+    /** Returns the type. */
+    uint8_t getType() const;
+    /** Returns the ID of the sender. */
+    NodeID getSource() const;
+    /** Returns the size. */
+    uint16_t getSize() const;
+    /** Returns the number of bytes the packet occupies in a datagram (header
+     *  and payload). The next coalesced packet, if any, begins here.
+     */
+    size_t getLength() const;
+    /** Returns the data payload. */
+    const uint8_t* getBytes() const;
+    /** Returns whether or not the view is of the same type as a concrete
+     *  packet.
+     */
+    template <class PacketClass> bool isType() const
+    {
+      return getType() == PacketClass::TYPE;
+    }
+  private:
+    const uint8_t* datagram;
+  };
+  
   /** Abstract network packet. A network packet has a source (ID of node who
    *  sent the packet), a type (identifier for the type of data carried), a 
    *  size (the amount of data carried), and finally a data payload.
@@ -33,11 +76,18 @@ namespace wic
   class AbstractPacket
   {
   public:
+    /** The size of the wire header: a version byte, the type, a 16-bit
+     *  source, and a 16-bit payload size (both in network byte order).
+     */
     const static size_t HEADER_SIZE;
+    /** The wire format version. Datagrams of any other version are dropped. */
+    const static uint8_t VERSION;
     /** Default constructor. */
     AbstractPacket();
     /** Returns the data payload. */
     vector<uint8_t> getData() const;
+    /** Returns the data payload without copying it. */
+    const uint8_t* getBytes() const;
     /** Returns the ID of the sender. */
     NodeID getSource() const;
     /** Populates a buffer to send over the network.
@@ -45,17 +95,29 @@ namespace wic
      *  \param source the desired source of the packet
      */
     void toBuffer(uint8_t* dest, NodeID source) const;
+    /** Populates a buffer to send over the network, checking its capacity.
+     *  \param dest destination buffer
+     *  \param capacity the size of the destination buffer
+     *  \param source the desired source of the packet
+     *  \return the number of bytes written
+     *  \exception InvalidArgument "packet cannot be larger than capacity"
+     */
+    size_t toBuffer(uint8_t* dest, size_t capacity, NodeID source) const;
     /** Returns the type. */
     virtual uint8_t getType() const = 0;
     /** Returns the size. */
-    virtual uint8_t getSize() const = 0;
+    virtual uint16_t getSize() const = 0;
   protected:
     vector<uint8_t> data;
+    const uint8_t* view; // payload not owned by the packet, if any
     NodeID source;
   };
   /** Concrete packet of a specific type. Specific packets are subclasses of
    *  Packet. Subclasses should define two static, constant variables: TYPE
-   *  and SIZE.
+   *  and SIZE. Subclasses may describe their fields with a Schema named
+   *  Layout, in which case SIZE should be Layout::SIZE. Packets carrying a
+   *  variable amount of data treat SIZE as the size of their fixed fields
+   *  and call setSize when constructed.
    */
   template <class Subclass> class Packet : public AbstractPacket
   {
@@ -63,14 +125,32 @@ namespace wic
     /** Constructor. This constructor is used to convert MysteryPackets into
      *  concrete packets. The constructor performs a check to make sure the
      *  conversion is valid.
+     *  \exception InvalidArgument "packet" "of another type"
+     *  \exception InvalidArgument "packet" "smaller than SIZE"
      */
     Packet(const AbstractPacket& other)
+    : size_(other.getSize())
     {
-      data = other.getData();
+      check(other.getType(), other.getSize());
+      data.assign(other.getBytes(), other.getBytes() + other.getSize());
       source = other.getSource();
     }
+    /** Constructor. This constructor wraps a recieved packet without copying
+     *  its payload; the result is only valid as long as the view is. The
+     *  same check is made as when converting a MysteryPacket.
+     *  \exception InvalidArgument "packet" "of another type"
+     *  \exception InvalidArgument "packet" "smaller than SIZE"
+     */
+    Packet(const PacketView& view)
+    : size_(view.getSize())
+    {
+      check(view.getType(), view.getSize());
+      this->view = view.getBytes();
+      source = view.getSource();
+    }
     /** Default constructor. */
     Packet()
+    : size_(Subclass::SIZE)
     {
       data.resize(getSize());
     }
@@ -78,10 +158,50 @@ namespace wic
     {
       return Subclass::TYPE;
     }
-    uint8_t getSize() const
+    uint16_t getSize() const
+    {
+      return size_;
+    }
+    /** Serializes a packet straight into a buffer, without constructing it
+     *  or making virtual calls. The subclass must declare a Layout and carry
+     *  nothing beyond it.
+     *  \param dest destination buffer; must hold HEADER_SIZE + SIZE bytes
+     *  \param source the desired source of the packet
+     *  \param values the value of every field of the Layout, in order
+     *  \return the number of bytes written
+     */
+    template <typename... Values>
+    static size_t encode(uint8_t* dest, NodeID source,
+                         const Values&... values)
     {
-      return Subclass::SIZE;
+      dest[0] = VERSION;
+      dest[1] = Subclass::TYPE;
+      U16::write(&dest[2], source);
+      U16::write(&dest[4], Subclass::SIZE);
+      Subclass::Layout::encode(dest + HEADER_SIZE, values...);
+      return HEADER_SIZE + Subclass::SIZE;
     }
+  protected:
+    /** Resizes the payload of a packet under construction.
+     *  \param size the new size
+     */
+    void setSize(uint16_t size)
+    {
+      data.resize(size);
+      size_ = size;
+    }
+  private:
+    /** Checks that a recieved packet can be read as this type, since the
+     *  fields are read at fixed offsets.
+     */
+    static void check(uint8_t type, uint16_t size)
+    {
+      if(type != Subclass::TYPE)
+        throw InvalidArgument("packet", "of another type");
+      if(size < Subclass::SIZE)
+        throw InvalidArgument("packet", "smaller than SIZE");
+    }
+    uint16_t size_;
   };
   
   /** Packet of undetermined type. MysteryPackets are recieved. */
@@ -97,8 +217,12 @@ namespace wic
      *  \param other another packet
      */
     void populate(const AbstractPacket& other);
+    /** Populates the packet from a view, copying its payload
+     *  \param view a packet view
+     */
+    void populate(const PacketView& view);
     uint8_t getType() const;
-    uint8_t getSize() const;
+    uint16_t getSize() const;
     /** Returns whether or not the mystery packet is of the same type as a 
      *  concrete packet.
      */
@@ -108,7 +232,7 @@ namespace wic
     }
   private:
     uint8_t type_;
-    uint8_t size_;
+    uint16_t size_;
   };
   
   /** Packet a client sends to a server when requesting to join. */
@@ -117,13 +241,14 @@ namespace wic
   public:
     using Packet::Packet;
     /** Constructor.
-     *  \param name client name
+     *  \param name client name; limited to 20 characters
      */
     JoinRequest(string name);
     static const uint8_t TYPE = 0;
-    static const uint8_t SIZE = 21;
+    typedef Schema<Text<21>> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
     /** Returns the client's name */
-    string name();
+    TextView name() const;
   };
   
   /** The packet a server sends to a client in response to a join request. */
@@ -135,12 +260,13 @@ namespace wic
      *  \param responseCode response code (OK, FULL, or BANNED)
      *  \param maxID maximum ID of the server
      *  \param assignedID ID assigned to the new client
-     *  \param serverName server name
+     *  \param serverName server name; limited to 20 characters
      */
     JoinResponse(uint8_t responseCode, NodeID maxID, NodeID assignedID,
                  string serverName);
     static const uint8_t TYPE = 1;
-    static const uint8_t SIZE = 24;
+    typedef Schema<U8, U16, U16, Text<21>> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
     /** Returns whether or not join is ok. */
     bool ok() const;
     /** Returns whether or not join failed due to a full server. */
@@ -148,11 +274,11 @@ namespace wic
     /** Returns whether or not join failed because the client is banned. */
     bool banned() const;
     /** Returns the maximum ID the server supports. */
-    uint8_t maxID() const;
+    NodeID maxID() const;
     /** Returns the new ID assigned to the client. */
     NodeID assignedID() const;
     /** Returns the server's name. */
-    string serverName() const;
+    TextView serverName() const;
     static const uint8_t OK;     /**< successful join  code */
     static const uint8_t FULL;   /**< failed join code due to full server */
     static const uint8_t BANNED; /**< failed join code due to client ban */
@@ -164,18 +290,19 @@ namespace wic
     using Packet::Packet;
     /** Constructor.
      *  \param newID ID of the new client
-     *  \param newName name of the new client
+     *  \param newName name of the new client; limited to 20 characters
      */
     ClientJoined(NodeID newID, string newName);
     static const uint8_t TYPE = 2;
-    static const uint8_t SIZE = 22;
+    typedef Schema<U16, Text<21>> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
     /** Returns the new client's ID. */
     NodeID newID() const;
     /** Returns the new client's name. */
-    string newName() const;
+    TextView newName() const;
   };
-  /** The packet sent from a server to a new client notifying them of an
-   *  existing client. 
+  /** Packet describing one existing client. Servers describe the existing
+   *  clients to a new client with a Roster instead.
    */
   class ClientInfo : public Packet<ClientInfo>
   {
@@ -183,15 +310,16 @@ namespace wic
     using Packet::Packet;
     /** Constructor.
      *  \param ID ID of existing client
-     *  \param name name of existing client
+     *  \param name name of existing client; limited to 20 characters
      */
     ClientInfo(NodeID ID, string name);
     static const uint8_t TYPE = 3;
-    static const uint8_t SIZE = 22;
+    typedef Schema<U16, Text<21>> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
     /** Returns the existing client's ID. */
     NodeID ID() const;
     /** Returns the existing client's name. */
-    string name() const;
+    TextView name() const;
   };
   /** Packet sent from a client to a server when the client leaves. */
   class Leaving : public Packet<Leaving>
@@ -201,7 +329,8 @@ namespace wic
     /** Default constructor. */
     Leaving();
     static const uint8_t TYPE = 4;
-    static const uint8_t SIZE = 0;
+    typedef Schema<> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
   };
   /** Packet sent from a server to a client that kicks the client. */
   class Kick : public Packet<Kick>
@@ -209,13 +338,14 @@ namespace wic
   public:
     using Packet::Packet;
     /** Constructor.
-     *  \param reason reason for the kick
+     *  \param reason reason for the kick; limited to 50 characters
      */
     Kick(string reason);
     static const uint8_t TYPE = 5;
-    static const uint8_t SIZE = 51;
+    typedef Schema<Text<51>> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
     /** Returns the reason for the kick. */
-    string reason() const;
+    TextView reason() const;
   };
   /** Packet sent from a server to a client that bans the client. */
   class Ban : public Packet<Ban>
@@ -223,13 +353,14 @@ namespace wic
   public:
     using Packet::Packet;
     /** Constructor.
-     *  \param reason reason for the ban
+     *  \param reason reason for the ban; limited to 50 characters
      */
     Ban(string reason);
     static const uint8_t TYPE = 6;
-    static const uint8_t SIZE = 51;
+    typedef Schema<Text<51>> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
     /** Returns the reason for the ban. */
-    string reason() const;
+    TextView reason() const;
   };
   /** Packet sent from a server to all connected clients when a client leaves */
   class ClientLeft : public Packet<ClientLeft>
@@ -239,11 +370,13 @@ namespace wic
     /** Constructor.
      *  \param oldID ID of old client
      *  \param leaveCode code indicating leave condition
-     *  \param reason reason for ban/kick (if applicable)
+     *  \param reason reason for ban/kick (if applicable); limited to 50
+     *         characters
      */
     ClientLeft(NodeID oldID, uint8_t leaveCode, string reason);
     static const uint8_t TYPE = 7;
-    static const uint8_t SIZE = 53;
+    typedef Schema<U16, U8, Text<51>> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
     /** Returns ID of old client. */
     NodeID oldID() const;
     /** Returns whether or not the client left normally. */
@@ -252,11 +385,14 @@ namespace wic
     bool kicked() const;
     /** Returns whether or not the client left due to ban. */
     bool banned() const;
+    /** Returns whether or not the client was dropped for going silent. */
+    bool timedOut() const;
     /** Returns the reason for ban/kick (if applicable) */
-    string reason() const;
+    TextView reason() const;
     static const uint8_t NORMAL; /**< left normally code */
     static const uint8_t KICKED; /**< kicked code */
     static const uint8_t BANNED; /**< banned code */
+    static const uint8_t TIMED_OUT; /**< timed out code */
   };
   /** Packet sent from a server to connected clients indicating server
    *  shutdown.
@@ -268,7 +404,230 @@ namespace wic
     /** Default constructor. */
     Shutdown();
     static const uint8_t TYPE = 8;
-    static const uint8_t SIZE = 0; 
+    typedef Schema<> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
+  };
+  /** Packet sent from a server to a client carrying a snapshot of the game
+   *  state, encoded as a delta against an earlier snapshot (see DeltaCodec).
+   */
+  class Snapshot : public Packet<Snapshot>
+  {
+  public:
+    using Packet::Packet;
+    /** Constructor.
+     *  \param tick the tick of the snapshot
+     *  \param baseTick the tick of the snapshot the delta is against, or zero
+     *         if the delta is against an empty snapshot
+     *  \param delta the encoded delta
+     *  \param length the length of the encoded delta
+     */
+    Snapshot(uint32_t tick, uint32_t baseTick, const uint8_t* delta,
+             size_t length);
+    static const uint8_t TYPE = 9;
+    typedef Schema<U32, U32> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
+    /** Returns the tick of the snapshot. */
+    uint32_t tick() const;
+    /** Returns the tick of the baseline snapshot, or zero if none. */
+    uint32_t baseTick() const;
+    /** Returns the encoded delta. */
+    const uint8_t* delta() const;
+    /** Returns the length of the encoded delta. */
+    size_t deltaLength() const;
+  };
+  /** Packet sent from a client to a server acknowledging a snapshot. */
+  class SnapshotAck : public Packet<SnapshotAck>
+  {
+  public:
+    using Packet::Packet;
+    /** Constructor.
+     *  \param tick the tick of the recieved snapshot
+     */
+    SnapshotAck(uint32_t tick);
+    static const uint8_t TYPE = 10;
+    typedef Schema<U32> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
+    /** Returns the tick of the recieved snapshot. */
+    uint32_t tick() const;
+  };
+  /** Envelope carrying a packet over a reliable channel. Envelopes also
+   *  acknowledge the sequence numbers recently recieved from their
+   *  destination (see ReliableEndpoint).
+   */
+  class Reliable : public Packet<Reliable>
+  {
+  public:
+    using Packet::Packet;
+    /** Constructor.
+     *  \param flags the channel, combined with ORDERED and HAS_ACK as needed
+     *  \param sequence the sequence number of the envelope
+     *  \param order the position of the packet within an ordered channel
+     *  \param ack the newest sequence number recieved
+     *  \param ackBits bit n set if sequence number ack - 1 - n was recieved
+     *  \param packet the serialized packet being carried
+     *  \param length the length of the serialized packet
+     */
+    Reliable(uint8_t flags, uint16_t sequence, uint16_t order, uint16_t ack,
+             uint32_t ackBits, const uint8_t* packet, size_t length);
+    static const uint8_t TYPE = 11;
+    typedef Schema<U8, U16, U16, U16, U32> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
+    /** Returns the channel. */
+    uint8_t channel() const;
+    /** Returns whether or not the channel is ordered. */
+    bool ordered() const;
+    /** Returns whether or not the acknowledgement fields are set. */
+    bool hasAck() const;
+    /** Returns the sequence number. */
+    uint16_t sequence() const;
+    /** Returns the position within an ordered channel. */
+    uint16_t order() const;
+    /** Returns the newest sequence number recieved. */
+    uint16_t ack() const;
+    /** Returns the bits acknowledging the 32 sequence numbers before ack. */
+    uint32_t ackBits() const;
+    /** Returns the serialized packet being carried. */
+    const uint8_t* packet() const;
+    /** Returns the length of the serialized packet being carried. */
+    size_t packetLength() const;
+    static const uint8_t ORDERED = 0x80; /**< ordered channel flag */
+    static const uint8_t HAS_ACK = 0x40; /**< acknowledgement flag */
+  };
+  /** Packet acknowledging reliable envelopes when no envelope is going the
+   *  other way to carry the acknowledgement.
+   */
+  class Ack : public Packet<Ack>
+  {
+  public:
+    using Packet::Packet;
+    /** Constructor.
+     *  \param ack the newest sequence number recieved
+     *  \param ackBits bit n set if sequence number ack - 1 - n was recieved
+     */
+    Ack(uint16_t ack, uint32_t ackBits);
+    static const uint8_t TYPE = 12;
+    typedef Schema<U16, U32> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
+    /** Returns the newest sequence number recieved. */
+    uint16_t ack() const;
+    /** Returns the bits acknowledging the 32 sequence numbers before ack. */
+    uint32_t ackBits() const;
+  };
+  /** A piece of a packet too large to fit in one datagram. Packets are
+   *  fragmented and reassembled automatically.
+   */
+  class Fragment : public Packet<Fragment>
+  {
+  public:
+    using Packet::Packet;
+    /** Constructor.
+     *  \param message the ID of the fragmented packet
+     *  \param index the index of the piece
+     *  \param count the number of pieces
+     *  \param total the length of the serialized packet
+     *  \param bytes the piece
+     *  \param length the length of the piece
+     */
+    Fragment(uint16_t message, uint16_t index, uint16_t count, uint32_t total,
+             const uint8_t* bytes, size_t length);
+    static const uint8_t TYPE = 13;
+    typedef Schema<U16, U16, U16, U32> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
+    /** Returns the ID of the fragmented packet. */
+    uint16_t message() const;
+    /** Returns the index of the piece. */
+    uint16_t index() const;
+    /** Returns the number of pieces. */
+    uint16_t count() const;
+    /** Returns the length of the serialized packet. */
+    uint32_t total() const;
+    /** Returns the piece. */
+    const uint8_t* bytes() const;
+    /** Returns the length of the piece. */
+    size_t length() const;
+  };
+  /** Packet sent from a client to a server to show that the client is
+   *  still there. Heartbeats are sent and consumed automatically.
+   */
+  class Heartbeat : public Packet<Heartbeat>
+  {
+  public:
+    using Packet::Packet;
+    /** Default constructor. */
+    Heartbeat();
+    static const uint8_t TYPE = 14;
+    typedef Schema<> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
+  };
+  /** Packet sent from a server to a new client listing the connected
+   *  clients. After the count, each client takes three bytes (its ID and
+   *  the length of its name) plus its name, so a roster of many clients
+   *  needs far fewer datagrams than one ClientInfo per client.
+   */
+  class Roster : public Packet<Roster>
+  {
+  public:
+    using Packet::Packet;
+    /** Default constructor (empty roster). */
+    Roster();
+    /** Appends a client.
+     *  \param ID the client's ID
+     *  \param name the client's name; limited to 20 characters
+     *  \return false if the roster is full, in which case nothing is
+     *          appended
+     */
+    bool add(NodeID ID, string name);
+    static const uint8_t TYPE = 15;
+    typedef Schema<U16> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
+    /** Returns the number of clients listed. */
+    uint16_t count() const;
+    /** Returns the IDs of the clients listed. */
+    vector<NodeID> IDs() const;
+    /** Returns the names of the clients listed, in the same order as IDs. */
+    vector<string> names() const;
+  };
+  /** Packet sent from a client to a server asking for the server's time
+   *  (see Client::getServerTime). Time requests are sent and consumed
+   *  automatically.
+   */
+  class TimeRequest : public Packet<TimeRequest>
+  {
+  public:
+    using Packet::Packet;
+    /** Constructor.
+     *  \param clientTime the client's clock, in microseconds, when sent
+     */
+    TimeRequest(uint64_t clientTime);
+    static const uint8_t TYPE = 16;
+    typedef Schema<U64> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
+    /** Returns the client's clock when the request was sent. */
+    uint64_t clientTime() const;
+  };
+  /** Packet sent from a server to a client answering a TimeRequest. Time
+   *  responses are consumed automatically.
+   */
+  class TimeResponse : public Packet<TimeResponse>
+  {
+  public:
+    using Packet::Packet;
+    /** Constructor. Server times are in microseconds (see Server::getTime).
+     *  \param clientTime the client's clock from the request
+     *  \param serverReceived the server's clock when the request arrived
+     *  \param serverSent the server's clock when answered
+     */
+    TimeResponse(uint64_t clientTime, uint64_t serverReceived,
+                 uint64_t serverSent);
+    static const uint8_t TYPE = 17;
+    typedef Schema<U64, U64, U64> Layout;
+    static const uint16_t SIZE = Layout::SIZE;
+    /** Returns the client's clock from the request. */
+    uint64_t clientTime() const;
+    /** Returns the server's clock when the request arrived. */
+    uint64_t serverReceived() const;
+    /** Returns the server's clock when the request was answered. */
+    uint64_t serverSent() const;
   };
   
 }
@@ -47,6 +47,8 @@ namespace wic
     Pair();
     /** Copy constructor. */
     Pair(const Pair& other);
+    /** Assignment operator. */
+    Pair& operator=(const Pair& other);
     /** Computes the distance to another Pair
      *  \param other another Pair
      *  \return the distance between the Pairs, in whatever units the Pairs
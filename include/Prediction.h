@@ -0,0 +1,135 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Prediction.h
+ * ----------------------------------------------------------------------------
+ */
+/** \file */
+#ifndef PREDICTION_H
+#define PREDICTION_H
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+#include "Error.h"
+namespace wic
+{
+  /** Predicts a local entity from its inputs, so that input takes effect at
+   *  once rather than a round trip later. Each input is applied to the
+   *  predicted state at once and kept, numbered, until the server
+   *  acknowledges it. The client sends each input to the server with its
+   *  number; the server applies inputs in order and sends back its state
+   *  with the number of the last input it applied. reconcile then starts
+   *  from that authoritative state and replays the inputs the server had
+   *  not applied yet, so mispredictions are corrected without undoing input
+   *  the server has yet to see. The function that applies an input is bound
+   *  at compile time, for example Predictor<Pair, Move, &applyMove>; the
+   *  server should step the entity with the same function so that
+   *  predictions agree with it.
+   */
+  template <class State, class Input,
+            void (*Apply)(State&, const Input&)>
+  class Predictor
+  {
+  public:
+    /** Constructor.
+     *  \param initial the initial state
+     *  \param capacity the most unacknowledged inputs kept; must be > 0
+     */
+    Predictor(const State& initial, size_t capacity)
+    : state(initial), next(1), acknowledged(0), capacity(capacity)
+    {
+      if(capacity == 0)
+        throw InvalidArgument("capacity", "zero");
+    }
+    /** Applies an input to the predicted state and keeps it for replay. If
+     *  capacity inputs are already unacknowledged, the oldest is forgotten;
+     *  it stays applied to the prediction but is not replayed.
+     *  \param input the input
+     *  \return the number of the input, to be sent to the server with it
+     */
+    uint32_t apply(const Input& input)
+    {
+      Apply(state, input);
+      if(pending.size() == capacity)
+        pending.pop_front();
+      Entry entry;
+      entry.number = next;
+      entry.input = input;
+      pending.push_back(entry);
+      return next++;
+    }
+    /** Replaces the predicted state with an authoritative state from the
+     *  server, then replays the inputs the server had not applied.
+     *  \param acknowledged the number of the last input the server applied,
+     *         or zero if none
+     *  \param authoritative the server's state after applying that input
+     *  \return false if the state is older than one already reconciled, in
+     *          which case it is ignored
+     */
+    bool reconcile(uint32_t acknowledged, const State& authoritative)
+    {
+      if(acknowledged < this->acknowledged)
+        return false;
+      this->acknowledged = acknowledged;
+      while(!pending.empty() && pending.front().number <= acknowledged)
+        pending.pop_front();
+      state = authoritative;
+      for(size_t i = 0; i < pending.size(); i++)
+        Apply(state, pending[i].input);
+      return true;
+    }
+    /** Replaces the predicted state and forgets every unacknowledged
+     *  input, for example after the entity respawns.
+     *  \param state the new state
+     */
+    void reset(const State& state)
+    {
+      this->state = state;
+      pending.clear();
+    }
+    /** Returns the predicted state. */
+    const State& getState() const
+    {
+      return state;
+    }
+    /** Returns the number of unacknowledged inputs. */
+    size_t getPending() const
+    {
+      return pending.size();
+    }
+    /** Returns the number of the last input the server acknowledged, or
+     *  zero if none.
+     */
+    uint32_t getAcknowledged() const
+    {
+      return acknowledged;
+    }
+  private:
+    /** A numbered input. */
+    struct Entry
+    {
+      uint32_t number;
+      Input input;
+    };
+    State state;
+    std::deque<Entry> pending; // oldest first
+    uint32_t next;             // number of the next input
+    uint32_t acknowledged;
+    size_t capacity;
+  };
+}
+#endif
@@ -0,0 +1,79 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Reassembler.h
+ * ----------------------------------------------------------------------------
+ */
+/** \file */
+#ifndef REASSEMBLER_H
+#define REASSEMBLER_H
+#include "Reliable.h"
+namespace wic
+{
+  /** Rebuilds packets that were split into Fragment packets. Partial
+   *  packets are kept in pooled buffers that are reused once a packet is
+   *  complete. The memory held by partial packets is bounded; when a new
+   *  packet would exceed the bound, the oldest partial packets are dropped.
+   *  Partial packets that stay incomplete for too long are dropped as well.
+   */
+  class Reassembler
+  {
+  public:
+    /** Constructor (4 MiB for partial packets, 5 second timeout). */
+    Reassembler();
+    /** Sets the limits on partial packets.
+     *  \param maxBytes the most memory held by partial packets
+     *  \param timeout the time, in seconds, a partial packet is kept; must
+     *         be > 0
+     */
+    void setLimits(size_t maxBytes, double timeout);
+    /** Adds a recieved fragment to its packet.
+     *  \param fragment the fragment
+     *  \param slot an index identifying the sender
+     *  \param now the current time
+     *  \return the serialized packet if the fragment completed it, otherwise
+     *          nullptr. The packet is valid until the next call.
+     */
+    const vector<uint8_t>* add(const PacketView& fragment, size_t slot,
+                               NetClock::time_point now);
+    /** Drops the partial packets of a sender. */
+    void forget(size_t slot);
+    /** Returns the memory held by partial packets, in bytes. */
+    size_t getPending() const;
+  private:
+    /** A packet being reassembled. */
+    struct Message
+    {
+      Message();
+      bool active;
+      size_t slot;
+      uint16_t id;
+      uint16_t count;
+      uint16_t received;
+      vector<uint8_t> data;
+      vector<bool> have;
+      NetClock::time_point started;
+    };
+    void drop(Message& message);
+    vector<Message> messages; // inactive messages keep their buffers
+    vector<uint8_t> complete;
+    size_t pending;
+    size_t maxBytes;
+    double timeout;
+  };
+}
+#endif
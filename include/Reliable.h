@@ -0,0 +1,147 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Reliable.h
+ * ----------------------------------------------------------------------------
+ */
+/** \file */
+#ifndef RELIABLE_H
+#define RELIABLE_H
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+using std::vector;
+namespace wic
+{
+  class PacketView;
+  /** The clock used for network timing. */
+  typedef std::chrono::steady_clock NetClock;
+  /** The reliable channel state between a node and one peer. Packets pushed
+   *  onto the endpoint are wrapped in Reliable envelopes, each with a
+   *  sequence number, and retransmitted until acknowledged. Every envelope
+   *  acknowledges the newest sequence number recieved from the peer along
+   *  with a bitfield covering the 32 before it, so acknowledgements ride on
+   *  traffic that is sent anyway. Retransmission waits for a timeout derived
+   *  from the measured round-trip time, doubling with every retry, unless a
+   *  later envelope is acknowledged first (fast retransmission). At most
+   *  WINDOW envelopes are in flight; further packets wait in a backlog.
+   *  Ordered channels hold packets that arrive early until the gap before
+   *  them is filled.
+   */
+  class ReliableEndpoint
+  {
+  public:
+    /** Constructor. */
+    ReliableEndpoint();
+    /** Forgets all state, as if newly constructed. */
+    void reset();
+    /** Queues a serialized packet for reliable delivery.
+     *  \param packet the serialized packet
+     *  \param length the length of the serialized packet
+     *  \param channel the channel; must be < CHANNELS
+     *  \param ordered whether or not the channel is ordered
+     *  \return false if the backlog is full
+     */
+    bool push(const uint8_t* packet, size_t length, uint8_t channel,
+              bool ordered);
+    /** Handles a recieved envelope, appending the serialized packets that
+     *  may now be delivered to out. Duplicates are dropped.
+     *  \param envelope the envelope
+     *  \param now the current time
+     *  \param out the destination of deliverable packets
+     *  \return true if the envelope's channel is ordered
+     */
+    bool receive(const PacketView& envelope, NetClock::time_point now,
+                 vector<uint8_t>& out);
+    /** Handles a recieved Ack packet.
+     *  \param ack the packet
+     *  \param now the current time
+     */
+    void acknowledge(const PacketView& ack, NetClock::time_point now);
+    /** Serializes envelopes that are due for transmission (and an Ack if
+     *  one is owed and no envelope carries it) back to back.
+     *  \param now the current time
+     *  \param source the ID of the sending node
+     *  \param dest the destination buffer
+     *  \param capacity the size of the destination buffer
+     *  \return the number of bytes written; zero once nothing is due
+     */
+    size_t emit(NetClock::time_point now, uint16_t source, uint8_t* dest,
+                size_t capacity);
+    /** Returns whether or not nothing is in flight, waiting, or owed. */
+    bool isIdle() const;
+    /** Returns the length of the largest packet in flight or waiting, or
+     *  zero if there is none. Each is sent whole, in an envelope OVERHEAD
+     *  bytes larger.
+     */
+    size_t getLargest() const;
+    /** Returns the smoothed round-trip time in seconds (zero until
+     *  measured).
+     */
+    double getRTT() const;
+    /** The number of channels. */
+    static const uint8_t CHANNELS = 8;
+    /** The most envelopes in flight at once. The acknowledgement bitfield
+     *  covers exactly this many sequence numbers.
+     */
+    static const uint16_t WINDOW = 33;
+    /** The most packets waiting for room in the window. */
+    static const size_t MAX_BACKLOG = 1024;
+    /** The bytes an envelope adds to the packet it carries. */
+    static const size_t OVERHEAD = 17;
+  private:
+    /** A packet waiting for, or holding, a sequence number. */
+    struct Entry
+    {
+      Entry();
+      vector<uint8_t> packet;
+      uint8_t flags;
+      uint16_t order;
+      bool used;
+      bool sent;
+      bool resent;
+      NetClock::time_point firstSent;
+      NetClock::time_point lastSent;
+      NetClock::time_point nextSend;
+      double interval;
+    };
+    void acknowledge(uint16_t ack, uint32_t ackBits, NetClock::time_point now);
+    void fill();
+    double timeout() const;
+    // Sending
+    uint16_t nextSequence;
+    uint16_t oldest;                  // oldest sequence number in flight
+    Entry window[64];                 // indexed by sequence number % 64
+    std::deque<Entry> backlog;
+    uint16_t nextOrder[CHANNELS];
+    double srtt;
+    double rttvar;
+    bool sampled;
+    // Recieving
+    bool receivedAny;
+    bool ackOwed;
+    uint16_t latest;
+    uint32_t latestBits;              // bit n: latest - 1 - n recieved
+    uint16_t expected[CHANNELS];
+    std::map<uint16_t, vector<uint8_t>> held[CHANNELS];
+  };
+}
+#endif
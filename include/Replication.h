@@ -0,0 +1,164 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Replication.h
+ * ----------------------------------------------------------------------------
+ */
+/** \file */
+#ifndef REPLICATION_H
+#define REPLICATION_H
+#include <algorithm>
+#include "Server.h"
+#include "Client.h"
+namespace wic
+{
+  /** Encodes snapshots as deltas against earlier snapshots. A delta begins
+   *  with the length of the snapshot. The snapshot is XORed with its
+   *  baseline (padded with zeros), and the result is stored as alternating
+   *  runs: a count of unchanged bytes, then a count of changed bytes
+   *  followed by those bytes. Lengths and counts are varints.
+   */
+  class DeltaCodec
+  {
+  public:
+    /** Encodes a snapshot as a delta against a baseline.
+     *  \param state the snapshot
+     *  \param length the length of the snapshot
+     *  \param base the baseline
+     *  \param baseLength the length of the baseline; zero for none
+     *  \param dest the destination buffer
+     *  \param capacity the size of the destination buffer
+     *  \return the length of the delta, or zero if it does not fit
+     */
+    static size_t encode(const uint8_t* state, size_t length,
+                         const uint8_t* base, size_t baseLength,
+                         uint8_t* dest, size_t capacity);
+    /** Rebuilds a snapshot from a delta and its baseline.
+     *  \param delta the delta
+     *  \param deltaLength the length of the delta
+     *  \param base the baseline the delta was encoded against
+     *  \param baseLength the length of the baseline; zero for none
+     *  \param dest the destination of the snapshot; resized to fit
+     *  \return false if the delta is malformed
+     */
+    static bool decode(const uint8_t* delta, size_t deltaLength,
+                       const uint8_t* base, size_t baseLength,
+                       vector<uint8_t>& dest);
+    /** The largest snapshot that can be decoded, in bytes. */
+    static const size_t MAX_LENGTH = 1 << 24;
+  };
+  /** Replicates game state from a server to its clients. Each tick, the
+   *  server hands the sender a snapshot of the game state. Each client is
+   *  sent that snapshot encoded as a delta against the newest snapshot it
+   *  has acknowledged, so only changed bytes cross the network. Clients
+   *  rebuild and acknowledge snapshots with a SnapshotReceiver.
+   */
+  class SnapshotSender
+  {
+  public:
+    /** Constructor.
+     *  \param server the server to send snapshots through
+     *  \param history the number of past snapshots kept as baselines; must
+     *         be > 0
+     */
+    SnapshotSender(Server& server, unsigned history);
+    /** Constructor (keeps 32 past snapshots). 
+     *  \param server the server to send snapshots through
+     */
+    SnapshotSender(Server& server);
+    /** Advances the tick and queues a snapshot for every client. Clients
+     *  whose acknowledged snapshot is no longer kept are sent the whole
+     *  snapshot. Snapshots are sent by Server::update, fragmented if they
+     *  do not fit within the server's MTU.
+     *  \param state the snapshot
+     *  \param length the length of the snapshot
+     *  \exception InvalidArgument "delta > 65527 bytes"
+     */
+    void send(const uint8_t* state, size_t length);
+    /** Advances the tick and queues a snapshot for every client. 
+     *  \param state the snapshot
+     *  \exception InvalidArgument "delta > 65527 bytes"
+     */
+    void send(const vector<uint8_t>& state);
+    /** Handles a recieved packet, recording acknowledgements.
+     *  \param packet the packet
+     *  \return true if the packet was a SnapshotAck, false otherwise
+     */
+    bool handle(const PacketView& packet);
+    /** Handles a recieved packet, recording acknowledgements.
+     *  \param packet the packet
+     *  \return true if the packet was a SnapshotAck, false otherwise
+     */
+    bool handle(const AbstractPacket& packet);
+    /** Returns the tick of the newest snapshot, or zero if none. */
+    uint32_t getTick() const;
+  private:
+    void acknowledge(NodeID sourceID, uint32_t ackTick);
+    /** Forgets a client's acknowledgements if another client now holds its
+     *  ID (see Server::getGeneration).
+     */
+    void track(NodeID ID);
+    Server& server;
+    uint32_t tick;
+    vector<vector<uint8_t>> history; // indexed by tick % history.size()
+    vector<uint32_t> historyTicks;
+    vector<uint32_t> acked;          // per client; zero if none
+    vector<uint32_t> generations;    // per client, when acked was set
+    vector<vector<uint8_t>> deltas;  // per baseline slot; last for none
+    vector<uint32_t> deltaTicks;     // tick each delta was encoded for
+    vector<size_t> baseSlots;        // per client, during send
+  };
+  /** Rebuilds the snapshots sent by a SnapshotSender. */
+  class SnapshotReceiver
+  {
+  public:
+    /** Constructor.
+     *  \param client the client to acknowledge snapshots through
+     *  \param history the number of past snapshots kept as baselines; must
+     *         be > 0
+     */
+    SnapshotReceiver(Client& client, unsigned history);
+    /** Constructor (keeps 32 past snapshots). 
+     *  \param client the client to acknowledge snapshots through
+     */
+    SnapshotReceiver(Client& client);
+    /** Handles a recieved packet. Snapshots newer than the current one are
+     *  rebuilt (if their baseline is still kept) and acknowledged. 
+     *  Acknowledgements are sent by Client::update.
+     *  \param packet the packet
+     *  \return true if the packet was a Snapshot, false otherwise
+     */
+    bool handle(const PacketView& packet);
+    /** Handles a recieved packet. 
+     *  \param packet the packet
+     *  \return true if the packet was a Snapshot, false otherwise
+     */
+    bool handle(const AbstractPacket& packet);
+    /** Returns the newest snapshot. */
+    const vector<uint8_t>& getSnapshot() const;
+    /** Returns the tick of the newest snapshot, or zero if none. */
+    uint32_t getTick() const;
+  private:
+    void apply(const Snapshot& snapshot);
+    Client& client;
+    uint32_t tick;
+    vector<vector<uint8_t>> history; // indexed by tick % history.size()
+    vector<uint32_t> historyTicks;
+    vector<uint8_t> scratch;
+  };
+}
+#endif
@@ -0,0 +1,223 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Schema.h
+ * ----------------------------------------------------------------------------
+ */
+/** \file */
+#ifndef SCHEMA_H
+#define SCHEMA_H
+#include <string>
+#include <cstring>
+#include <stdint.h>
+#include "Error.h"
+using std::string;
+namespace wic
+{
+  /** A read-only view of a string field. The view points into the packet
+   *  it was read from and is only valid as long as the packet is. The
+   *  string ends at the first null or at the field's capacity, whichever
+   *  comes first, so malformed packets cannot cause overreads.
+   */
+  class TextView
+  {
+  public:
+    /** Constructor.
+     *  \param data the field
+     *  \param capacity the size of the field
+     */
+    TextView(const char* data, size_t capacity);
+    /** Returns the characters; not necessarily null-terminated. */
+    const char* data() const;
+    /** Returns the number of characters. */
+    size_t length() const;
+    /** Returns a copy as a string. */
+    string str() const;
+    /** Returns a copy as a string. */
+    operator string() const;
+    /** Returns whether or not the view holds the same characters as a
+     *  string.
+     */
+    bool operator==(const string& other) const;
+    /** Returns whether or not the view differs from a string. */
+    bool operator!=(const string& other) const;
+  private:
+    const char* data_;
+    size_t length_;
+  };
+  
+  /** An unsigned 8-bit field. */
+  struct U8
+  {
+    typedef uint8_t Value;
+    static const size_t SIZE = 1;
+    static uint8_t read(const uint8_t* src)
+    {
+      return src[0];
+    }
+    static void write(uint8_t* dest, uint8_t value)
+    {
+      dest[0] = value;
+    }
+  };
+  /** An unsigned 16-bit field, in network byte order. */
+  struct U16
+  {
+    typedef uint16_t Value;
+    static const size_t SIZE = 2;
+    static uint16_t read(const uint8_t* src)
+    {
+      return (src[0] << 8) | src[1];
+    }
+    static void write(uint8_t* dest, uint16_t value)
+    {
+      dest[0] = value >> 8;
+      dest[1] = value & 0xFF;
+    }
+  };
+  /** An unsigned 32-bit field, in network byte order. */
+  struct U32
+  {
+    typedef uint32_t Value;
+    static const size_t SIZE = 4;
+    static uint32_t read(const uint8_t* src)
+    {
+      return ((uint32_t) U16::read(src) << 16) | U16::read(src + 2);
+    }
+    static void write(uint8_t* dest, uint32_t value)
+    {
+      U16::write(dest, value >> 16);
+      U16::write(dest + 2, value & 0xFFFF);
+    }
+  };
+  /** An unsigned 64-bit field, in network byte order. */
+  struct U64
+  {
+    typedef uint64_t Value;
+    static const size_t SIZE = 8;
+    static uint64_t read(const uint8_t* src)
+    {
+      return ((uint64_t) U32::read(src) << 32) | U32::read(src + 4);
+    }
+    static void write(uint8_t* dest, uint64_t value)
+    {
+      U32::write(dest, value >> 32);
+      U32::write(dest + 4, value & 0xFFFFFFFF);
+    }
+  };
+  /** A string field of fixed capacity. Strings shorter than the capacity
+   *  are padded with nulls.
+   */
+  template <size_t CAPACITY> struct Text
+  {
+    typedef TextView Value;
+    static const size_t SIZE = CAPACITY;
+    static TextView read(const uint8_t* src)
+    {
+      return TextView((const char*) src, CAPACITY);
+    }
+    /** \exception InvalidArgument "string > CAPACITY-1 characters" */
+    static void write(uint8_t* dest, const string& value)
+    {
+      if(value.size() >= CAPACITY)
+        throw InvalidArgument("string",
+                              "> " + std::to_string(CAPACITY - 1) +
+                              " characters");
+      memcpy(dest, value.data(), value.size());
+      memset(dest + value.size(), 0, CAPACITY - value.size());
+    }
+  };
+  
+  /** The type and offset of the field at an index of a schema. */
+  template <size_t INDEX, typename... Fields> struct SchemaField;
+  template <typename First, typename... Rest>
+  struct SchemaField<0, First, Rest...>
+  {
+    typedef First Type;
+    static const size_t OFFSET = 0;
+  };
+  template <size_t INDEX, typename First, typename... Rest>
+  struct SchemaField<INDEX, First, Rest...>
+  {
+    typedef typename SchemaField<INDEX - 1, Rest...>::Type Type;
+    static const size_t OFFSET = First::SIZE +
+                                 SchemaField<INDEX - 1, Rest...>::OFFSET;
+  };
+  
+  /** The layout of a packet's fields, computed at compile time. Fields are
+   *  packed back to back in the order given, with no padding, so reading or
+   *  writing a field is a load or store at a constant offset. Packets
+   *  declare their layout as a typedef named Layout and their SIZE as
+   *  Layout::SIZE:
+   *  \code
+   *  typedef Schema<U16, U8, Text<51>> Layout;
+   *  static const uint16_t SIZE = Layout::SIZE;
+   *  NodeID oldID() const { return Layout::get<0>(getBytes()); }
+   *  \endcode
+   */
+  template <typename... Fields> struct Schema;
+  template <> struct Schema<>
+  {
+    static const size_t SIZE = 0;
+    static void encode(uint8_t*)
+    {
+    }
+  };
+  template <typename First, typename... Rest> struct Schema<First, Rest...>
+  {
+    /** The total size of the fields. */
+    static const size_t SIZE = First::SIZE + Schema<Rest...>::SIZE;
+    /** The type of the field at an index. */
+    template <size_t INDEX> struct Field
+    {
+      typedef typename SchemaField<INDEX, First, Rest...>::Type Type;
+      static const size_t OFFSET = SchemaField<INDEX, First, Rest...>::OFFSET;
+    };
+    /** Reads the field at an index.
+     *  \param bytes the payload
+     */
+    template <size_t INDEX>
+    static typename Field<INDEX>::Type::Value get(const uint8_t* bytes)
+    {
+      return Field<INDEX>::Type::read(bytes + Field<INDEX>::OFFSET);
+    }
+    /** Writes the field at an index.
+     *  \param bytes the payload
+     *  \param value the value
+     */
+    template <size_t INDEX, typename Value>
+    static void set(uint8_t* bytes, const Value& value)
+    {
+      Field<INDEX>::Type::write(bytes + Field<INDEX>::OFFSET, value);
+    }
+    /** Writes every field.
+     *  \param bytes the payload
+     *  \param value the value of the first field
+     *  \param values the values of the remaining fields, in order
+     */
+    template <typename Value, typename... Values>
+    static void encode(uint8_t* bytes, const Value& value,
+                       const Values&... values)
+    {
+      static_assert(sizeof...(Values) == sizeof...(Rest),
+                    "a schema is encoded from one value per field");
+      First::write(bytes, value);
+      Schema<Rest...>::encode(bytes + First::SIZE, values...);
+    }
+  };
+}
+#endif
@@ -21,10 +21,24 @@
 /** \file */
 #ifndef SERVER_H
 #define SERVER_H
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include "Packet.h"
+#include "Dispatch.h"
+#include "Interest.h"
+#include "TimerWheel.h"
 namespace wic
 {
-  /** A server node that connects to multiple client nodes. */
+  /** A server node that connects to multiple client nodes.
+   *
+   *  Every method but recv and recvBatch takes an internal roster lock, so
+   *  may be called from any thread. The immediate sends (send, sendExclude,
+   *  sendAll, sendBatch, sendNear, and sendNearExclude) hold the lock only
+   *  while looking up their recipients, so several threads may serialize
+   *  and send at once. recv and recvBatch must be called from one thread at
+   *  a time (see Node).
+   */
   class Server : public Node
   {
   public:
@@ -32,11 +46,35 @@ namespace wic
      *  \param name server's name; limited to 20 characters
      *  \param port port number on which to listen for packets; must be > 1024
      *  \param maxClients maximum simultaneously connected clients; must be
-     *         in the range 1-254
+     *         in the range 1-65534
      *  \exception Failure "port already in use"
      */
-    Server(string name, unsigned port, uint8_t maxClients);
+    Server(string name, unsigned port, NodeID maxClients);
+    /** Constructor (starts a sharded server). A sharded server binds several
+     *  sockets to the same port (SO_REUSEPORT) and drains each on its own
+     *  worker thread. Workers handle joins, leaves, and source verification
+     *  in parallel; the roster and ID allocation are shared between them
+     *  under a lock. Each client belongs to the shard that recieved its join,
+     *  which on Linux is chosen by a hash of the client's address. Packets
+     *  from unknown sources are always dropped by a sharded server.
+     *  \param name server's name; limited to 20 characters
+     *  \param port port number on which to listen for packets; must be > 1024
+     *  \param maxClients maximum simultaneously connected clients; must be
+     *         in the range 1-65534
+     *  \param shardCount the number of shards; 1 disables sharding
+     *  \exception Failure "port already in use"
+     */
+    Server(string name, unsigned port, NodeID maxClients,
+           unsigned shardCount);
     ~Server();
+    /** Returns the number of shards (1 if not sharded). */
+    unsigned getShardCount() const;
+    /** Starts a dedicated I/O thread (see Node::startIOThread). Sharded
+     *  servers already have one thread per shard.
+     *  \exception Error "sharded servers drain their sockets on worker
+     *             threads"
+     */
+    void startIOThread();
     /** Sends a packet to a single client.
      *  \param packet the packet to send
      *  \param destID the ID of the recipient
@@ -51,11 +89,171 @@ namespace wic
      *  \param packet the packet to send
      */
     void sendAll(const AbstractPacket& packet) const;
+    /** Sends several packets to a single client using as few system calls as
+     *  possible.
+     *  \param packets the packets to send
+     *  \param destID the ID of the recipient
+     */
+    void sendBatch(const vector<const AbstractPacket*>& packets,
+                   NodeID destID) const;
+    /** Queues a packet for a single client. Queued packets are coalesced into
+     *  as few datagrams as possible (see setMTU), which are sent by update
+     *  or as soon as they fill.
+     *  \param packet the packet to queue; fragmented if larger than getMTU()
+     *  \param destID the ID of the recipient
+     */
+    void queue(const AbstractPacket& packet, NodeID destID);
+    /** Queues a packet for all clients except one.
+     *  \param packet the packet to queue; fragmented if larger than getMTU()
+     *  \param excludeID the ID of the excluded client
+     */
+    void queueExclude(const AbstractPacket& packet, NodeID excludeID);
+    /** Queues a packet for all clients.
+     *  \param packet the packet to queue; fragmented if larger than getMTU()
+     */
+    void queueAll(const AbstractPacket& packet);
+    /** Queues a packet for a single client on a reliable channel. The packet
+     *  is sent by update, and sent again by later updates until the client
+     *  acknowledges it.
+     *  \param packet the packet to queue; fragmented if it does not fit
+     *         within getMTU() along with ReliableEndpoint::OVERHEAD
+     *  \param destID the ID of the recipient
+     *  \param channel the channel; must be < CHANNELS
+     *  \exception Failure "reliable backlog full"
+     */
+    void sendReliable(const AbstractPacket& packet, NodeID destID,
+                      uint8_t channel);
+    /** Queues a packet for all clients on a reliable channel.
+     *  \param packet the packet to queue; fragmented if it does not fit
+     *         within getMTU() along with ReliableEndpoint::OVERHEAD
+     *  \param channel the channel; must be < CHANNELS
+     *  \exception Failure "reliable backlog full"
+     */
+    void sendReliableAll(const AbstractPacket& packet, uint8_t channel);
+    /** Limits the rate at which queued packets are sent to a client. Each
+     *  update sends the queued packets that fit within the limit in order of
+     *  priority (see setPriority); the rest are held back for later updates.
+     *  Packets sent with send, rather than queued, are not limited.
+     *  \param ID the ID of the client
+     *  \param bytesPerSecond the limit, or zero for no limit
+     */
+    void setBandwidth(NodeID ID, size_t bytesPerSecond);
+    /** Limits the rate at which queued packets are sent to every client,
+     *  including clients that join later.
+     *  \param bytesPerSecond the limit, or zero for no limit
+     */
+    void setBandwidthAll(size_t bytesPerSecond);
+    /** Sets the region of the world a client is interested in. Packets sent
+     *  with sendNear or queueNear reach only the clients whose regions
+     *  contain the packet's position; clients without a region receive none
+     *  of them. A client's region is forgotten when it leaves.
+     *  \param ID the ID of the client
+     *  \param view the region
+     */
+    void setView(NodeID ID, const Bounds& view);
+    /** Forgets the region a client is interested in.
+     *  \param ID the ID of the client
+     */
+    void clearView(NodeID ID);
+    /** Sets the size of the grid cells used to match positions to regions.
+     *  Cells about the size of a typical region work best. 
+     *  \param cellSize the side length of a cell; must be > 0
+     */
+    void setCellSize(double cellSize);
+    /** Sends a packet to every client interested in a position.
+     *  \param packet the packet to send
+     *  \param position the position the packet concerns
+     */
+    void sendNear(const AbstractPacket& packet, const Pair& position);
+    /** Sends a packet to every client interested in a position except one.
+     *  \param packet the packet to send
+     *  \param position the position the packet concerns
+     *  \param excludeID the ID of the excluded client
+     */
+    void sendNearExclude(const AbstractPacket& packet, const Pair& position,
+                         NodeID excludeID);
+    /** Queues a packet for every client interested in a position.
+     *  \param packet the packet to queue; fragmented if larger than getMTU()
+     *  \param position the position the packet concerns
+     */
+    void queueNear(const AbstractPacket& packet, const Pair& position);
+    /** Queues a packet for every client interested in a position except one.
+     *  \param packet the packet to queue; fragmented if larger than getMTU()
+     *  \param position the position the packet concerns
+     *  \param excludeID the ID of the excluded client
+     */
+    void queueNearExclude(const AbstractPacket& packet, const Pair& position,
+                          NodeID excludeID);
+    /** Sends all queued packets, including reliable packets that are due to
+     *  be sent again, and drops clients that have timed out (see
+     *  setTimeout). This should be called once per frame.
+     */
+    void update();
+    /** Sets how long a client may go unheard before update drops it. By
+     *  default clients are never dropped. Clients send a Heartbeat every
+     *  second from Client::update, so only clients that crashed, lost their
+     *  connection, or stopped calling Client::update are dropped. The other
+     *  clients are sent a ClientLeft, and recv reports the same ClientLeft,
+     *  with the code TIMED_OUT.
+     *  \param seconds the timeout, or zero to never drop clients; must be
+     *         >= 0, and should be a few times the heartbeat interval
+     */
+    void setTimeout(double seconds);
+    /** Returns how long a client may go unheard before it is dropped, or
+     *  zero if clients are never dropped.
+     */
+    double getTimeout() const;
+    /** Returns the server's clock: the seconds since the server started.
+     *  Clients estimate this clock (see Client::getServerTime) by sending
+     *  TimeRequests, which are answered and consumed by recv.
+     */
+    double getTime() const;
+    /** Returns a count that changes whenever a client takes an ID, so that
+     *  per-client state kept elsewhere (see SnapshotSender) can tell a new
+     *  client from an old one that had the same ID.
+     *  \param ID the client ID; must be <= maxID
+     */
+    uint32_t getGeneration(NodeID ID) const;
     /** Attempts to recieve a single packet. 
      *  \param result the destination of the received packet
      *  \return true if packet recieved, false otherwise
      */
     bool recv(MysteryPacket& result);
+    /** Attempts to recieve many packets using as few system calls as possible.
+     *  Unlike recv, packets from unknown sources are silently dropped.
+     *  \param results the destination of the recieved packets; resized to the
+     *         number of packets recieved
+     *  \param max the maximum number of datagrams to recieve; capped at
+     *         RING_SIZE. Datagrams may hold several packets.
+     *  \return the number of packets recieved
+     */
+    size_t recvBatch(vector<MysteryPacket>& results, size_t max);
+    /** Attempts to recieve many packets without copying or allocating.
+     *  Unlike recv, packets from unknown sources are silently dropped.
+     *  \param results the destination of the recieved packets; resized to the
+     *         number of packets recieved. The views are valid until the next
+     *         call to recv or recvBatch.
+     *  \param max the maximum number of datagrams to recieve; capped at
+     *         RING_SIZE. Datagrams may hold several packets.
+     *  \return the number of packets recieved
+     */
+    size_t recvBatch(vector<PacketView>& results, size_t max);
+    /** Attempts to recieve many packets from a single shard without copying
+     *  or allocating. Different shards may be read concurrently, one thread
+     *  per shard, so long as no thread reads all shards at once via recv or
+     *  the other recvBatch overloads. Packets that are not delivered in the
+     *  datagrams that carried them (those on ordered reliable channels,
+     *  reassembled packets, and the ClientLeft of a client that timed out)
+     *  are recieved from shard 0 alone, so shard 0 must be read.
+     *  \param results the destination of the recieved packets; resized to the
+     *         number of packets recieved. The views are valid until the next
+     *         call to recvBatch for the same shard.
+     *  \param max the maximum number of datagrams to recieve; capped at
+     *         RING_SIZE. Datagrams may hold several packets.
+     *  \param shard the shard to read; must be < getShardCount()
+     *  \return the number of packets recieved
+     */
+    size_t recvBatch(vector<PacketView>& results, size_t max, unsigned shard);
     /** Kicks a client by ID.
      *  \param ID the ID of the client to be kicked
      *  \param reason the reason; limited to 50 characters
@@ -85,9 +283,96 @@ namespace wic
      */
     NodeID getNodeID(string nameOrIP) const;
   private:
+    /** A socket sharing the server port, drained by its own worker thread. */
+    struct Shard
+    {
+      Shard(int sock, size_t slotSize);
+      int sock;
+      DatagramRing ring;
+      size_t held;
+      std::thread worker;
+    };
+    void work(unsigned index);
+    void releaseShards();
+    size_t takeShard(Shard& shard, size_t max);
+    size_t collectShard(Shard& shard, vector<PacketView>& results,
+                        size_t count, size_t max);
+    /** Serializes a packet once and sends it to every client but one (or
+     *  every client if excludeID is zero).
+     */
+    void broadcast(const AbstractPacket& packet, NodeID excludeID) const;
+    /** Serializes a packet once and sends it to the recipients. */
+    void sendRecipients(const AbstractPacket& packet) const;
+    /** Returns the address of a client, under the roster lock. */
+    struct sockaddr_in lookup(NodeID destID) const;
+    /** Serializes a packet once and queues it for every client but one (or
+     *  every client if excludeID is zero).
+     */
+    void queueBroadcast(const AbstractPacket& packet, NodeID excludeID);
+    /** Serializes a packet once and sends it to the clients interested in a
+     *  position but one (or all of them if excludeID is zero).
+     */
+    void sendNearby(const AbstractPacket& packet, const Pair& position,
+                    NodeID excludeID);
+    /** Serializes a packet once and queues it for the clients interested in
+     *  a position but one (or all of them if excludeID is zero).
+     */
+    void queueNearby(const AbstractPacket& packet, const Pair& position,
+                     NodeID excludeID);
+    /** Queues a packet on a reliable channel for every client but one (or
+     *  every client if excludeID is zero), optionally transmitting at once.
+     */
+    void reliableBroadcast(const AbstractPacket& packet, NodeID excludeID,
+                           uint8_t channel, bool immediately);
+    bool process(Datagram& datagram, unsigned shard);
+    /** Delivers a verified packet from a client, copying it into the
+     *  datagram being rebuilt or releasing it. Fragments are reassembled.
+     */
+    void deliver(const uint8_t* bytes, NodeID sourceID, bool isOrdered,
+                 uint8_t* accepted, size_t& length);
+    void onHeartbeat(const Heartbeat& heartbeat);
+    void onTimeRequest(const TimeRequest& timeRequest);
+    void onLeaving(const Leaving& leaving);
+    Datagram* nextDatagram(bool& unknown);
+    size_t gather(vector<PacketView>& results, size_t max);
+    /** Records a connection in the roster and its indexes. */
+    void connect(NodeID ID, const struct sockaddr_in& clientAddr,
+                 const string& clientName, const string& ip, unsigned shard);
+    /** Announces that a client left and disconnects it. */
+    void leave(NodeID ID);
+    /** Drops the clients whose timeouts have expired. */
+    void expire(NetClock::time_point now);
+    /** Frees a connection's ID and removes it from the indexes. */
+    void disconnect(NodeID ID);
+    void unindex(const string& key, NodeID ID);
+    /** Returns the key of an address in addrIndex. */
+    static uint64_t addrKey(const struct sockaddr_in& addr);
     vector<string> ips;
-    vector<string> blacklist;
+    std::unordered_set<string> blacklist;
+    std::unordered_multimap<string, NodeID> clientIndex;
+    std::unordered_map<uint64_t, NodeID> addrIndex;
+    vector<uint64_t> freeIDs; // bit set for every unused client ID
+    NodeID clientCount;
     vector<struct sockaddr_in> addrs;
+    vector<unsigned> shardOf;
+    vector<Shard*> shards;
+    unsigned nextShard;
+    vector<PacketView> views;
+    vector<uint8_t> unwrapped;
+    InterestGrid interest;
+    size_t bandwidth; // limit for clients that join
+    vector<NodeID> nearby;
+    static thread_local vector<struct sockaddr_in> recipients;
+    TimerWheel timeouts;          // when each client is next checked
+    vector<NetClock::time_point> lastSeen;
+    vector<uint32_t> generations; // per ID, bumped by connect
+    vector<uint16_t> expired;
+    NetClock::duration timeout;
+    NetClock::time_point started;
+    NetClock::time_point arrival; // when the datagram in process arrived
+    atomic<bool> sharding;
+    mutable std::recursive_mutex rosterMutex;
+    Dispatcher control; // handles the control packets clients send
   };
 }
 #endif
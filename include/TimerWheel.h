@@ -0,0 +1,86 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    TimerWheel.h
+ * ----------------------------------------------------------------------------
+ */
+/** \file */
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+#include <vector>
+#include <stdint.h>
+#include "Reliable.h"
+#include "Error.h"
+using std::vector;
+namespace wic
+{
+  /** A hashed timer wheel holding at most one timer per key. Time is cut
+   *  into ticks of a fixed resolution, and each timer is linked into the
+   *  slot of the tick it expires on (modulo the number of slots), so
+   *  scheduling and cancelling take constant time and advancing visits only
+   *  the slots of the ticks that passed. Timers never fire early, but may
+   *  fire up to one tick late.
+   */
+  class TimerWheel
+  {
+  public:
+    /** Constructor.
+     *  \param slots the number of slots; must be a power of two
+     *  \param resolution the length of a tick in seconds; must be > 0
+     */
+    TimerWheel(size_t slots, double resolution);
+    /** Schedules, or reschedules, the timer of a key.
+     *  \param key the key
+     *  \param when when the timer expires
+     */
+    void schedule(uint16_t key, NetClock::time_point when);
+    /** Cancels the timer of a key, if scheduled.
+     *  \param key the key
+     */
+    void cancel(uint16_t key);
+    /** Returns whether or not the timer of a key is scheduled. */
+    bool isScheduled(uint16_t key) const;
+    /** Returns the number of scheduled timers. */
+    size_t getSize() const;
+    /** Advances the wheel, unscheduling the timers that expired.
+     *  \param now the current time
+     *  \param expired replaced with the keys of the expired timers
+     */
+    void advance(NetClock::time_point now, vector<uint16_t>& expired);
+  private:
+    /** A timer, linked into the list of its slot. */
+    struct Timer
+    {
+      Timer();
+      uint64_t due;      // tick on which the timer expires
+      uint32_t prev;
+      uint32_t next;
+      bool scheduled;
+    };
+    uint64_t tickOf(NetClock::time_point when) const;
+    void unlink(uint16_t key);
+    static const uint32_t NONE = 0xFFFFFFFF;
+    vector<Timer> timers;   // indexed by key
+    vector<uint32_t> heads; // first timer of each slot
+    size_t mask;
+    double resolution;
+    NetClock::time_point origin;
+    uint64_t current;       // every tick up to this one has been processed
+    size_t size;
+  };
+}
+#endif
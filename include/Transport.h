@@ -0,0 +1,143 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Transport.h
+ * ----------------------------------------------------------------------------
+ */
+/** \file */
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+#include <map>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+#include <strings.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "DatagramRing.h"
+#include "Reliable.h"
+#include "Error.h"
+using std::vector;
+namespace wic
+{
+  /** Moves datagrams between a node's sockets and the network. Nodes use a
+   *  SocketTransport unless given another (see Node::setTransport).
+   *  Transports may be shared by several nodes and called from several
+   *  threads at once.
+   */
+  class Transport
+  {
+  public:
+    /** Destructor. */
+    virtual ~Transport();
+    /** Receives datagrams without blocking.
+     *  \param fd the socket
+     *  \param datagrams max destination datagrams; lengths of zero mark
+     *         datagrams that should be ignored
+     *  \param bufferSize the size of each datagram's buffer
+     *  \param max the maximum number of datagrams; must be <= BATCH_SIZE
+     *  \return the number of datagrams received
+     */
+    virtual size_t recv(int fd, Datagram* const* datagrams, size_t bufferSize,
+                        size_t max) = 0;
+    /** Sends datagrams. Datagrams that cannot be sent are dropped.
+     *  \param fd the socket
+     *  \param datagrams the datagrams
+     *  \param count the number of datagrams
+     */
+    virtual void send(int fd, const Datagram* datagrams, size_t count) = 0;
+    /** The most datagrams received by one call to recv. */
+    static const size_t BATCH_SIZE = 64;
+  };
+  /** Transport straight to the kernel, using as few system calls as
+   *  possible (recvmmsg and sendmmsg where available).
+   */
+  class SocketTransport : public Transport
+  {
+  public:
+    size_t recv(int fd, Datagram* const* datagrams, size_t bufferSize,
+                size_t max);
+    void send(int fd, const Datagram* datagrams, size_t count);
+  };
+  /** Transport that simulates a poor network on top of the kernel. Sent
+   *  datagrams may be dropped, duplicated, delayed and reordered before they
+   *  reach the socket; held datagrams are released by later calls to send or
+   *  recv. Random decisions are drawn from a seeded generator, so a given
+   *  seed and sequence of sends always meets the same fate. Only outbound
+   *  datagrams are impaired; give every node its own ImpairedTransport, or
+   *  share one, to impair both directions.
+   */
+  class ImpairedTransport : public Transport
+  {
+  public:
+    /** Constructor (no impairments).
+     *  \param seed the seed of the random generator
+     */
+    ImpairedTransport(uint32_t seed);
+    /** Sets the one-way delay added to every datagram.
+     *  \param seconds the delay; must be >= 0
+     */
+    void setLatency(double seconds);
+    /** Sets the random variation of the delay. Each datagram's delay is
+     *  drawn uniformly from latency - jitter to latency + jitter (but never
+     *  below zero), so jitter alone reorders datagrams.
+     *  \param seconds the variation; must be >= 0
+     */
+    void setJitter(double seconds);
+    /** Sets the probability that a datagram is dropped.
+     *  \param probability the probability; must be in the range 0-1
+     */
+    void setLoss(double probability);
+    /** Sets the probability that a datagram is sent twice.
+     *  \param probability the probability; must be in the range 0-1
+     */
+    void setDuplication(double probability);
+    /** Sets the probability that a datagram is held back, arriving after
+     *  datagrams sent later.
+     *  \param probability the probability; must be in the range 0-1
+     *  \param delay the extra time, in seconds, a held back datagram waits;
+     *         must be >= 0
+     */
+    void setReordering(double probability, double delay);
+    /** Returns the number of datagrams waiting to be released. */
+    size_t getHeld() const;
+    size_t recv(int fd, Datagram* const* datagrams, size_t bufferSize,
+                size_t max);
+    void send(int fd, const Datagram* datagrams, size_t count);
+  private:
+    /** A datagram waiting to be released. */
+    struct Held
+    {
+      int fd;
+      struct sockaddr_in addr;
+      vector<uint8_t> data;
+    };
+    double random();
+    void release(NetClock::time_point now);
+    SocketTransport kernel;
+    mutable std::mutex mutex;
+    std::multimap<NetClock::time_point, Held> held; // by release time
+    uint32_t state;
+    double latency;
+    double jitter;
+    double loss;
+    double duplication;
+    double reordering;
+    double reorderDelay;
+  };
+}
+#endif
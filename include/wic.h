@@ -21,17 +21,23 @@
 /** \file include this file to gain access to the wic library */
 #ifndef WIC_H
 #define WIC_H
+#include "BitStream.h"
 #include "Bounds.h"
 #include "Client.h"
+#include "ClockSync.h"
 #include "Color.h"
+#include "Dispatch.h"
 #include "Error.h"
 #include "Font.h"
 #include "Game.h"
 #include "Image.h"
+#include "Interpolation.h"
 #include "Packet.h"
 #include "Pair.h"
 #include "Polygon.h"
+#include "Prediction.h"
 #include "Quad.h"
+#include "Replication.h"
 #include "Server.h"
 #include "Splash.h"
 #include "Text.h"
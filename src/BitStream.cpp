@@ -0,0 +1,228 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    BitStream.cpp
+ * ----------------------------------------------------------------------------
+ */
+#include "BitStream.h"
+namespace wic
+{
+  static const double TURN = 6.283185307179586;
+  
+  // Quantization helpers. The number of steps is 2^bits - 1 so that both
+  // ends of a range are represented exactly.
+  static void checkQuantization(double min, double max, unsigned bits)
+  {
+    if(!(max > min))
+      throw InvalidArgument("max", "<= min");
+    if(bits == 0)
+      throw InvalidArgument("bits", "zero");
+    if(bits > 32)
+      throw InvalidArgument("bits", "> 32");
+  }
+  static uint32_t quantize(double value, double min, double max,
+                           unsigned bits)
+  {
+    double steps = (double) ((((uint64_t) 1) << bits) - 1);
+    if(!(value > min))
+      return 0;
+    if(value >= max)
+      return (uint32_t) steps;
+    return (uint32_t) llround((value - min) / (max - min) * steps);
+  }
+  static double dequantize(uint32_t value, double min, double max,
+                           unsigned bits)
+  {
+    double steps = (double) ((((uint64_t) 1) << bits) - 1);
+    return min + value * ((max - min) / steps);
+  }
+  
+  BitWriter::BitWriter()
+  : bits(0)
+  {
+  }
+  void BitWriter::clear()
+  {
+    bytes.clear();
+    bits = 0;
+  }
+  void BitWriter::writeBits(uint32_t value, unsigned count)
+  {
+    if(count > 32)
+      throw InvalidArgument("count", "> 32");
+    if(count < 32)
+      value &= (((uint32_t) 1) << count) - 1;
+    while(count > 0)
+    {
+      // Fill the rest of the last byte, starting a new one if it is full
+      unsigned used = bits % 8;
+      if(used == 0)
+        bytes.push_back(0);
+      unsigned take = 8 - used < count ? 8 - used : count;
+      uint8_t chunk = (value >> (count - take)) & ((1 << take) - 1);
+      bytes.back() |= chunk << (8 - used - take);
+      count -= take;
+      bits += take;
+    }
+  }
+  void BitWriter::writeBool(bool value)
+  {
+    writeBits(value ? 1 : 0, 1);
+  }
+  void BitWriter::writeVarint(uint64_t value)
+  {
+    while(value >= 0x80)
+    {
+      writeBits((value & 0x7F) | 0x80, 8);
+      value >>= 7;
+    }
+    writeBits(value, 8);
+  }
+  void BitWriter::writeSignedVarint(int64_t value)
+  {
+    writeVarint(((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+  }
+  void BitWriter::writeFloat(double value, double min, double max,
+                             unsigned bits)
+  {
+    checkQuantization(min, max, bits);
+    writeBits(quantize(value, min, max, bits), bits);
+  }
+  void BitWriter::writePair(const Pair& value, const Bounds& bounds,
+                            unsigned bits)
+  {
+    writeFloat(value.x, bounds.lowerLeft.x, bounds.upperRight.x, bits);
+    writeFloat(value.y, bounds.lowerLeft.y, bounds.upperRight.y, bits);
+  }
+  void BitWriter::writeAngle(double radians, unsigned bits)
+  {
+    checkQuantization(0.0, TURN, bits);
+    // A full turn has 2^bits steps; the step at 2 pi wraps to zero
+    double turns = fmod(radians, TURN) / TURN;
+    if(turns < 0.0)
+      turns += 1.0;
+    uint64_t steps = ((uint64_t) 1) << bits;
+    writeBits((uint32_t) ((uint64_t) llround(turns * steps) % steps), bits);
+  }
+  void BitWriter::align()
+  {
+    bits = bytes.size() * 8;
+  }
+  const uint8_t* BitWriter::getBytes() const
+  {
+    return bytes.data();
+  }
+  size_t BitWriter::getLength() const
+  {
+    return bytes.size();
+  }
+  size_t BitWriter::getBits() const
+  {
+    return bits;
+  }
+  unsigned BitWriter::bitsFor(double range, double precision)
+  {
+    if(!(range > 0.0))
+      throw InvalidArgument("range", "<= 0");
+    if(!(precision > 0.0))
+      throw InvalidArgument("precision", "<= 0");
+    unsigned bits = 1;
+    while(bits < 32 && range / ((((uint64_t) 1) << bits) - 1) > precision)
+      bits++;
+    return bits;
+  }
+  
+  BitReader::BitReader(const uint8_t* bytes, size_t length)
+  : bytes(bytes), length(length * 8), position(0), overflowed(false)
+  {
+  }
+  uint32_t BitReader::readBits(unsigned count)
+  {
+    if(count > 32)
+      throw InvalidArgument("count", "> 32");
+    if(count > length - position)
+    {
+      overflowed = true;
+      position = length;
+      return 0;
+    }
+    uint32_t value = 0;
+    while(count > 0)
+    {
+      unsigned used = position % 8;
+      unsigned take = 8 - used < count ? 8 - used : count;
+      uint8_t byte = bytes[position / 8];
+      value = (value << take) | ((byte >> (8 - used - take)) &
+                                 ((1 << take) - 1));
+      count -= take;
+      position += take;
+    }
+    return value;
+  }
+  bool BitReader::readBool()
+  {
+    return readBits(1) != 0;
+  }
+  uint64_t BitReader::readVarint()
+  {
+    uint64_t value = 0;
+    for(unsigned shift = 0; shift < 64; shift += 7)
+    {
+      uint32_t group = readBits(8);
+      value |= (uint64_t) (group & 0x7F) << shift;
+      if(!(group & 0x80))
+        return value;
+    }
+    overflowed = true;
+    return 0;
+  }
+  int64_t BitReader::readSignedVarint()
+  {
+    uint64_t value = readVarint();
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+  }
+  double BitReader::readFloat(double min, double max, unsigned bits)
+  {
+    checkQuantization(min, max, bits);
+    return dequantize(readBits(bits), min, max, bits);
+  }
+  Pair BitReader::readPair(const Bounds& bounds, unsigned bits)
+  {
+    double x = readFloat(bounds.lowerLeft.x, bounds.upperRight.x, bits);
+    double y = readFloat(bounds.lowerLeft.y, bounds.upperRight.y, bits);
+    return Pair(x, y);
+  }
+  double BitReader::readAngle(unsigned bits)
+  {
+    checkQuantization(0.0, TURN, bits);
+    return readBits(bits) * (TURN / (((uint64_t) 1) << bits));
+  }
+  void BitReader::align()
+  {
+    position = (position + 7) / 8 * 8;
+    if(position > length)
+      position = length;
+  }
+  size_t BitReader::getBitsLeft() const
+  {
+    return length - position;
+  }
+  bool BitReader::hasOverflowed() const
+  {
+    return overflowed;
+  }
+}
@@ -0,0 +1,184 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Capture.cpp
+ * ----------------------------------------------------------------------------
+ */
+#include "Capture.h"
+namespace wic
+{
+  CaptureWriter::CaptureWriter(string path)
+  : file(fopen(path.data(), "wb")), started(NetClock::now()), count(0),
+    failed(false)
+  {
+    if(!file)
+      throw Failure("capture file could not be created");
+    uint8_t header[5];
+    U32::write(header, MAGIC);
+    U8::write(header + 4, VERSION);
+    if(fwrite(header, 1, sizeof(header), file) != sizeof(header))
+    {
+      fclose(file);
+      throw Failure("capture file could not be created");
+    }
+  }
+  CaptureWriter::~CaptureWriter()
+  {
+    fclose(file);
+  }
+  bool CaptureWriter::write(uint8_t direction, const Datagram& datagram)
+  {
+    if(datagram.length == 0)
+      return true;
+    uint64_t time = std::chrono::duration_cast<std::chrono::microseconds>(
+      NetClock::now() - started).count();
+    uint8_t header[RECORD_HEADER];
+    U8::write(header, direction);
+    U64::write(header + 1, time);
+    U32::write(header + 9, ntohl(datagram.addr.sin_addr.s_addr));
+    U16::write(header + 13, ntohs(datagram.addr.sin_port));
+    U16::write(header + 15, datagram.length);
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    if(failed)
+      return false;
+    if(fwrite(header, 1, RECORD_HEADER, file) != RECORD_HEADER ||
+       fwrite(datagram.data, 1, datagram.length, file) != datagram.length)
+    {
+      failed = true;
+      return false;
+    }
+    count++;
+    return true;
+  }
+  size_t CaptureWriter::getCount() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return count;
+  }
+  bool CaptureWriter::hasFailed() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return failed;
+  }
+  
+  CaptureReader::CaptureReader(string path)
+  : file(fopen(path.data(), "rb"))
+  {
+    if(!file)
+      throw InvalidFile(path);
+    uint8_t header[5];
+    if(fread(header, 1, sizeof(header), file) != sizeof(header) ||
+       U32::read(header) != CaptureWriter::MAGIC ||
+       U8::read(header + 4) != CaptureWriter::VERSION)
+    {
+      fclose(file);
+      throw InvalidFile(path);
+    }
+  }
+  CaptureReader::~CaptureReader()
+  {
+    fclose(file);
+  }
+  bool CaptureReader::next(CaptureRecord& record)
+  {
+    uint8_t header[CaptureWriter::RECORD_HEADER];
+    if(fread(header, 1, sizeof(header), file) != sizeof(header))
+      return false;
+    record.direction = U8::read(header);
+    record.time = U64::read(header + 1) / 1e6;
+    bzero(&record.addr, sizeof(record.addr));
+    record.addr.sin_family = AF_INET;
+    record.addr.sin_addr.s_addr = htonl(U32::read(header + 9));
+    record.addr.sin_port = htons(U16::read(header + 13));
+    record.data.resize(U16::read(header + 15));
+    return fread(record.data.data(), 1, record.data.size(), file) ==
+           record.data.size();
+  }
+  void CaptureReader::rewind()
+  {
+    fseek(file, 5, SEEK_SET);
+  }
+  
+  ReplayTransport::ReplayTransport(string path, double speed)
+  : reader(path), speed(speed), finished(false), begun(false), origin(0.0),
+    replayed(0), sent(0)
+  {
+    if(!(speed >= 0.0))
+      throw InvalidArgument("speed", "< 0");
+    advance();
+    if(!finished)
+      origin = pending.time;
+  }
+  bool ReplayTransport::isFinished() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return finished;
+  }
+  size_t ReplayTransport::getReplayed() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return replayed;
+  }
+  size_t ReplayTransport::getSent() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return sent;
+  }
+  size_t ReplayTransport::recv(int, Datagram* const* datagrams,
+                               size_t bufferSize, size_t max)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    NetClock::time_point now = NetClock::now();
+    if(!begun)
+    {
+      begun = true;
+      started = now;
+    }
+    double elapsed = std::chrono::duration<double>(now - started).count() *
+                     speed;
+    size_t count = 0;
+    while(count < max && !finished &&
+          (speed == 0.0 || pending.time - origin <= elapsed))
+    {
+      Datagram& datagram = *datagrams[count++];
+      datagram.length = std::min(pending.data.size(), bufferSize);
+      memcpy(datagram.data, pending.data.data(), datagram.length);
+      datagram.addr = pending.addr;
+      replayed++;
+      advance();
+    }
+    return count;
+  }
+  void ReplayTransport::send(int, const Datagram*, size_t count)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    sent += count;
+  }
+  void ReplayTransport::advance()
+  {
+    do
+    {
+      if(!reader.next(pending))
+      {
+        finished = true;
+        return;
+      }
+    }
+    while(pending.direction != CaptureWriter::RECEIVED);
+  }
+}
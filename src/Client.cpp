@@ -21,119 +21,385 @@
 #include "Client.h"
 namespace wic
 {
-  const size_t bufferSize = 255;
-  uint8_t buffer[bufferSize];
+  const size_t SCRATCH_SIZE = 16384;
+  const double FIRST_RETRY = 0.2;  // seconds before the first resend
+  const double MAX_RETRY = 2.0;    // cap on the time between resends
+  const int MAX_WAIT = 10;         // milliseconds join sleeps at a time
+  const double HEARTBEAT = 1.0;    // seconds between heartbeats
+  const double SYNC_FAST = 0.1;    // seconds between time requests at first
+  const double SYNC_INTERVAL = 1.0; // and once synchronized
   Client::Client(string name, unsigned serverPort, string serverIP,
                  double timeout)
-  : Node(name)
+  : Client(name, serverPort, serverIP)
   {
+    join(timeout);
+  }
+  Client::Client(string name, unsigned serverPort, string serverIP)
+  : Node(name), joining(false), retryInterval(FIRST_RETRY),
+    epoch(NetClock::now())
+  {
+    // Packets from the server that change the roster
+    roster.setHandler<ClientJoined, Client, &Client::onClientJoined>(this);
+    roster.setHandler<Roster, Client, &Client::onRoster>(this);
+    roster.setHandler<ClientInfo, Client, &Client::onClientInfo>(this);
+    roster.setHandler<ClientLeft, Client, &Client::onClientLeft>(this);
+    roster.setHandler<Kick, Client, &Client::onKick>(this);
+    roster.setHandler<Ban, Client, &Client::onBan>(this);
+    roster.setHandler<Shutdown, Client, &Client::onShutdown>(this);
+    
     // Initialize server address
     bzero(&serverAddr, sizeof(serverAddr));
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_addr.s_addr = inet_addr(serverIP.data());
     serverAddr.sin_port = htons(serverPort);
+  }
+  Client::~Client() 
+  {
+    update();
+    if(joined)
+      send(Leaving());
+    stopIOThread();
+    close(sock);
+  }
+  void Client::join(double timeout)
+  {
+    beginJoin(timeout);
+    while(!pollJoin())
+    {
+      // Sleep until something arrives or the next request is due. Wake
+      // regularly regardless, so a transport holding datagrams back gets a
+      // chance to release them.
+      NetClock::time_point wake = std::min(nextRequest, deadline);
+      long long wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        wake - NetClock::now()).count() + 1;
+      if(wait > MAX_WAIT)
+        wait = MAX_WAIT;
+      if(wait < 0)
+        wait = 0;
+      struct pollfd fd;
+      fd.fd = sock;
+      fd.events = POLLIN;
+      poll(&fd, 1, (int) wait);
+    }
+  }
+  void Client::beginJoin(double timeout)
+  {
+    if(joined)
+      throw Error("already joined");
+    if(hasIOThread())
+      throw Error("cannot join while I/O thread is running");
+    if(!(timeout > 0.0))
+      throw InvalidArgument("timeout", "<= 0");
+    NetClock::time_point now = NetClock::now();
+    joining = true;
+    deadline = now + std::chrono::duration_cast<NetClock::duration>(
+      std::chrono::duration<double>(timeout));
+    retryInterval = FIRST_RETRY;
+    requestJoin(now);
+  }
+  bool Client::pollJoin()
+  {
+    if(joined)
+      return true;
+    if(!joining)
+      throw Error("not joining");
     
-    // Send a join request
-    JoinRequest pkt(name);
-    send(pkt);
-    
-    // Wait for, then process, the server's response
-    clock_t initial_clock = clock();
-    while((clock() - initial_clock)/CLOCKS_PER_SEC <= timeout)
+    // Read one datagram at a time, so whatever follows the response is left
+    // for recv. Anything else the server sends first is dropped; the roster
+    // channel retransmits it.
+    uint8_t data[Node::MTU];
+    Datagram datagram;
+    datagram.data = data;
+    Datagram* slot = &datagram;
+    while(recvDatagrams(sock, &slot, Node::MTU, 1) > 0)
     {
-      struct sockaddr_in recvAddr;
-      socklen_t tmpLen = sizeof(recvAddr);
-      ssize_t length = recvfrom(sock, buffer, bufferSize, 0,
-                                (struct sockaddr*) &recvAddr, &tmpLen);
-      // Process anything recieved
-      if(length > 0)
+      if(!PacketView::isValid(data, datagram.length))
+        continue;
+      PacketView packet(data);
+      if(!packet.isType<JoinResponse>() ||
+         packet.getSize() < JoinResponse::SIZE)
+        continue;
+      JoinResponse joinResponse(packet);
+      if(joinResponse.full() || joinResponse.banned())
       {
-        // Populate a mystery packet
-        MysteryPacket pkt;
-        pkt.populate((buffer));
-        if(pkt.isType<JoinResponse>())
-        {
-          // Process the recieved join response
-          JoinResponse joinResponse(pkt);
-          if(joinResponse.ok())
-          {
-            // Join successful, set everything up
-            joined = true;
-            ID = joinResponse.assignedID();
-            maxID = joinResponse.maxID();
-            used = vector<bool>(maxID, false);
-            used[0] = true;
-            used[ID] = true;
-            names.resize(getMaxNodes());
-            names[0] = joinResponse.serverName();
-            names[ID] = name;
-            serverAddr = recvAddr;
-            return;
-          }
-          else if(joinResponse.full())
-            throw Failure("server full");
-          else if(joinResponse.banned())
-            throw Failure("banned");
-        }
+        joining = false;
+        throw Failure(joinResponse.full() ? "server full" : "banned");
       }
+      if(!joinResponse.ok())
+        continue;
+      
+      // Join successful, set everything up
+      joining = false;
+      joined = true;
+      ID = joinResponse.assignedID();
+      maxID = joinResponse.maxID();
+      used = vector<bool>(getMaxNodes(), false);
+      used[0] = true;
+      used[ID] = true;
+      names.resize(getMaxNodes());
+      names[0] = joinResponse.serverName();
+      names[ID] = name;
+      serverAddr = datagram.addr;
+      clock.reset();
+      nextSync = NetClock::now();
+      return true;
     }
-    throw Failure("timeout");
+    
+    NetClock::time_point now = NetClock::now();
+    if(now >= deadline)
+    {
+      joining = false;
+      throw Failure("timeout");
+    }
+    if(now >= nextRequest)
+      requestJoin(now);
+    return false;
   }
-  Client::~Client() 
+  bool Client::isJoining() const
   {
-    if(joined)
-      send(Leaving());
-    close(sock);
+    return joining;
+  }
+  bool Client::isJoined() const
+  {
+    return joined;
+  }
+  void Client::requestJoin(NetClock::time_point now)
+  {
+    send(JoinRequest(name));
+    nextRequest = now + std::chrono::duration_cast<NetClock::duration>(
+      std::chrono::duration<double>(retryInterval));
+    retryInterval = std::min(retryInterval * 2.0, MAX_RETRY);
   }
   void Client::send(const AbstractPacket& packet) const
   {
-    size_t size = AbstractPacket::HEADER_SIZE + packet.getSize();
-    packet.toBuffer(buffer, ID);
-    sendto(sock, buffer, size, 0, (struct sockaddr*) &serverAddr, lenAddr);
+    sendPieces(fragment(packet, ID, getMTU()), serverAddr);
   }
-  bool Client::recv(MysteryPacket& result)
+  void Client::sendBatch(const vector<const AbstractPacket*>& packets) const
   {
-    // Pull data from the socket
-    struct sockaddr_in recvAddr;
-    socklen_t tmpLen = sizeof(recvAddr);
-    ssize_t length = recvfrom(sock, buffer, bufferSize, 0,
-                              (struct sockaddr*) &recvAddr, &tmpLen);
-    if(length > 0)
+    // Pack the serialized packets into one scratch area, flushing whenever
+    // it or the batch fills. Packets too large for one datagram are
+    // fragmented and sent on their own.
+    uint8_t scratch[SCRATCH_SIZE];
+    Datagram datagrams[BATCH_SIZE];
+    size_t count = 0;
+    size_t filled = 0;
+    for(size_t i = 0; i < packets.size(); i++)
     {
-      // Verify data comes from server and populate a mystery packet
-      if(recvAddr.sin_addr.s_addr == serverAddr.sin_addr.s_addr &&
-         recvAddr.sin_port == serverAddr.sin_port)
+      const AbstractPacket& packet = *packets[i];
+      size_t length = AbstractPacket::HEADER_SIZE + packet.getSize();
+      if(length > getMTU())
       {
-        result.populate(buffer);
-        
-        // Characterize and process the mystery packet
-        if(result.isType<ClientJoined>())
-        {
-          ClientJoined clientJoined(result);
-          used[clientJoined.newID()] = true;
-          names[clientJoined.newID()] = clientJoined.newName();
-        }
-        else if(result.isType<ClientInfo>())
-        {
-          ClientInfo clientInfo(result);
-          used[clientInfo.ID()] = true;
-          names[clientInfo.ID()] = clientInfo.name();
-        }
-        else if(result.isType<Kick>() ||
-                result.isType<Ban>()  ||
-                result.isType<Shutdown>())
-        {
-          joined = false;
-        }
-        else if(result.isType<ClientLeft>())
-        {
-          ClientLeft clientLeft(result);
-          used[clientLeft.oldID()] = false;
-        }
-        return true;
+        sendPieces(fragment(packet, ID, getMTU()), serverAddr);
+        continue;
       }
-      throw Error("packet recieved from unknown source");
+      if(count == BATCH_SIZE || filled + length > SCRATCH_SIZE)
+      {
+        sendDatagrams(datagrams, count);
+        count = 0;
+        filled = 0;
+      }
+      datagrams[count].data = scratch + filled;
+      datagrams[count].length = packet.toBuffer(scratch + filled, Node::MTU,
+                                                ID);
+      datagrams[count].addr = serverAddr;
+      filled += length;
+      count++;
+    }
+    if(count > 0)
+      sendDatagrams(datagrams, count);
+  }
+  void Client::queue(const AbstractPacket& packet)
+  {
+    queuePieces(fragment(packet, ID, getMTU()), 0, serverAddr);
+  }
+  void Client::sendReliable(const AbstractPacket& packet, uint8_t channel)
+  {
+    enqueueReliable(packet, ID, channel, 0, serverAddr);
+  }
+  void Client::setBandwidth(size_t bytesPerSecond)
+  {
+    setBudget(0, bytesPerSecond);
+  }
+  void Client::update()
+  {
+    // Keep the server from timing the client out. Sent at once, since a
+    // heartbeat held back by the bandwidth limit would be no heartbeat.
+    NetClock::time_point now = NetClock::now();
+    if(joined && now >= nextHeartbeat)
+    {
+      send(Heartbeat());
+      nextHeartbeat = now + std::chrono::duration_cast<NetClock::duration>(
+        std::chrono::duration<double>(HEARTBEAT));
     }
+    
+    // Sent at once, rather than queued, so bandwidth limits do not delay
+    // them and spoil the round-trip times
+    if(joined && now >= nextSync)
+    {
+      send(TimeRequest(std::chrono::duration_cast<std::chrono::microseconds>(
+        now - epoch).count()));
+      double interval = clock.isSynchronized() ? SYNC_INTERVAL : SYNC_FAST;
+      nextSync = now + std::chrono::duration_cast<NetClock::duration>(
+        std::chrono::duration<double>(interval));
+    }
+    flushAll();
+  }
+  bool Client::recv(MysteryPacket& result)
+  {
+    bool unknown = false;
+    if(recvPacket(result, unknown))
+      return true;
+    if(unknown)
+      throw Error("packet recieved from unknown source");
     return false;
   }
+  size_t Client::recvBatch(vector<MysteryPacket>& results, size_t max)
+  {
+    size_t count = recvViews(views, max);
+    if(results.size() < count)
+      results.resize(count);
+    for(size_t i = 0; i < count; i++)
+      results[i].populate(views[i]);
+    results.resize(count);
+    return count;
+  }
+  size_t Client::recvBatch(vector<PacketView>& results, size_t max)
+  {
+    return recvViews(results, max);
+  }
+  bool Client::isSynchronized() const
+  {
+    return clock.isSynchronized();
+  }
+  double Client::getServerTime() const
+  {
+    return clock.getRemoteTime(toLocal(NetClock::now()));
+  }
+  const ClockSync& Client::getClock() const
+  {
+    return clock;
+  }
+  double Client::toLocal(NetClock::time_point time) const
+  {
+    return std::chrono::duration<double>(time - epoch).count();
+  }
+  bool Client::process(Datagram& datagram, unsigned)
+  {
+    // Verify data comes from server
+    if(datagram.addr.sin_addr.s_addr != serverAddr.sin_addr.s_addr ||
+       datagram.addr.sin_port != serverAddr.sin_port)
+    {
+      datagram.length = 0;
+      return false;
+    }
+    
+    // Characterize and process each coalesced packet, dropping anything
+    // after the first malformed one. Envelopes are replaced by the packets
+    // they carry, so packets are moved down as they are kept.
+    size_t offset = 0;
+    size_t length = 0;
+    while(PacketView::isValid(datagram.data + offset,
+                              datagram.length - offset))
+    {
+      PacketView result(datagram.data + offset);
+      size_t next = offset + result.getLength();
+      if(result.isType<Reliable>())
+      {
+        // Packets on ordered channels are delivered after the datagrams of
+        // the current recv call
+        bool isOrdered = unwrap(result, 0, datagram.addr, unwrapped);
+        for(size_t i = 0; i < unwrapped.size();
+            i += PacketView(unwrapped.data() + i).getLength())
+          deliver(unwrapped.data() + i, isOrdered, datagram, length);
+      }
+      else if(result.isType<Ack>())
+        acknowledge(result, 0);
+      else
+        deliver(datagram.data + offset, false, datagram, length);
+      offset = next;
+    }
+    datagram.length = length;
+    return true;
+  }
+  void Client::deliver(const uint8_t* bytes, bool isOrdered,
+                       Datagram& datagram, size_t& length)
+  {
+    // Reassembled packets are too large to share a datagram, so they are
+    // delivered after the datagrams of the current recv call
+    PacketView packet(bytes);
+    if(packet.isType<Fragment>())
+    {
+      const vector<uint8_t>* whole = reassemble(packet, 0);
+      if(whole)
+      {
+        roster.dispatch(PacketView(whole->data()));
+        release(whole->data(), whole->size());
+      }
+      return;
+    }
+    if(packet.isType<TimeResponse>())
+    {
+      if(packet.getSize() < TimeResponse::SIZE)
+        return;
+      TimeResponse response(packet);
+      clock.addSample(response.clientTime() / 1e6,
+                      response.serverReceived() / 1e6,
+                      response.serverSent() / 1e6, toLocal(datagram.time));
+      return;
+    }
+    roster.dispatch(packet);
+    if(isOrdered)
+      release(bytes, packet.getLength());
+    else
+    {
+      memmove(datagram.data + length, bytes, packet.getLength());
+      length += packet.getLength();
+    }
+  }
+  void Client::onClientJoined(const ClientJoined& clientJoined)
+  {
+    if(clientJoined.newID() < used.size())
+    {
+      used[clientJoined.newID()] = true;
+      names[clientJoined.newID()] = clientJoined.newName();
+    }
+  }
+  void Client::onRoster(const Roster& roster)
+  {
+    vector<NodeID> IDs = roster.IDs();
+    vector<string> rosterNames = roster.names();
+    for(size_t i = 0; i < IDs.size(); i++)
+    {
+      if(IDs[i] < used.size())
+      {
+        used[IDs[i]] = true;
+        names[IDs[i]] = rosterNames[i];
+      }
+    }
+  }
+  void Client::onClientInfo(const ClientInfo& clientInfo)
+  {
+    if(clientInfo.ID() < used.size())
+    {
+      used[clientInfo.ID()] = true;
+      names[clientInfo.ID()] = clientInfo.name();
+    }
+  }
+  void Client::onClientLeft(const ClientLeft& clientLeft)
+  {
+    if(clientLeft.oldID() < used.size())
+      used[clientLeft.oldID()] = false;
+  }
+  void Client::onKick(const Kick&)
+  {
+    joined = false;
+  }
+  void Client::onBan(const Ban&)
+  {
+    joined = false;
+  }
+  void Client::onShutdown(const Shutdown&)
+  {
+    joined = false;
+  }
 }
@@ -0,0 +1,146 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    ClockSync.cpp
+ * ----------------------------------------------------------------------------
+ */
+#include "ClockSync.h"
+namespace wic
+{
+  const double ClockSync::MAX_RTT = 2.0;
+  const double TRUST = 1.5;           // trusted trips are within this factor
+  const double TRUST_MARGIN = 0.001;  // plus this, in seconds, of the best
+  const double MIN_SPAN = 2.0;        // seconds of samples needed for drift
+  const double MAX_DRIFT = 0.0005;    // cap on drift (500 ppm, as in NTP)
+  const double MAX_SLEW = 0.05;       // seconds slewed out every second
+  const double MAX_STEP = 0.25;       // larger differences are stepped
+  ClockSync::ClockSync()
+  {
+    reset();
+  }
+  void ClockSync::reset()
+  {
+    next = 0;
+    count = 0;
+    rtt = 0.0;
+    anchor = 0.0;
+    offset = 0.0;
+    drift = 0.0;
+    correction = 0.0;
+    corrected = 0.0;
+  }
+  bool ClockSync::addSample(double sent, double remoteReceived,
+                            double remoteSent, double received)
+  {
+    double trip = (received - sent) - (remoteSent - remoteReceived);
+    if(!(trip >= 0.0) || trip > MAX_RTT || remoteSent < remoteReceived)
+      return false;
+    bool wasSynchronized = isSynchronized();
+    double before = wasSynchronized ? getRemoteTime(received) : 0.0;
+    
+    Sample& sample = samples[next];
+    sample.local = (sent + received) / 2.0;
+    sample.offset = (remoteReceived + remoteSent) / 2.0 - sample.local;
+    sample.rtt = trip;
+    next = (next + 1) % SAMPLES;
+    if(count < SAMPLES)
+      count++;
+    
+    // Trust only the trips that queued about as little as the best one
+    rtt = samples[0].rtt;
+    for(size_t i = 1; i < count; i++)
+      rtt = std::min(rtt, samples[i].rtt);
+    double limit = rtt * TRUST + TRUST_MARGIN;
+    
+    // Fit a line through the trusted samples. Drift is only measured once
+    // they span long enough for it to stand out from the noise.
+    size_t trusted = 0;
+    double first = 0.0;
+    double last = 0.0;
+    double sumLocal = 0.0;
+    double sumOffset = 0.0;
+    for(size_t i = 0; i < count; i++)
+    {
+      if(samples[i].rtt > limit)
+        continue;
+      if(trusted == 0 || samples[i].local < first)
+        first = samples[i].local;
+      if(trusted == 0 || samples[i].local > last)
+        last = samples[i].local;
+      sumLocal += samples[i].local;
+      sumOffset += samples[i].offset;
+      trusted++;
+    }
+    anchor = sumLocal / trusted;
+    offset = sumOffset / trusted;
+    drift = 0.0;
+    if(last - first >= MIN_SPAN)
+    {
+      double covariance = 0.0;
+      double variance = 0.0;
+      for(size_t i = 0; i < count; i++)
+      {
+        if(samples[i].rtt > limit)
+          continue;
+        covariance += (samples[i].local - anchor) *
+                      (samples[i].offset - offset);
+        variance += (samples[i].local - anchor) * (samples[i].local - anchor);
+      }
+      drift = std::max(-MAX_DRIFT, std::min(MAX_DRIFT, covariance / variance));
+    }
+    
+    // Slew out small differences from the previous estimate
+    correction = 0.0;
+    corrected = received;
+    if(wasSynchronized)
+    {
+      double difference = before - estimate(received);
+      if(std::abs(difference) <= MAX_STEP)
+        correction = difference;
+    }
+    return true;
+  }
+  bool ClockSync::isSynchronized() const
+  {
+    return count >= MIN_SAMPLES;
+  }
+  double ClockSync::getRemoteTime(double local) const
+  {
+    if(!isSynchronized())
+      throw Error("not synchronized");
+    return estimate(local) + remaining(local);
+  }
+  double ClockSync::getRTT() const
+  {
+    return rtt;
+  }
+  double ClockSync::getDrift() const
+  {
+    return drift;
+  }
+  double ClockSync::estimate(double local) const
+  {
+    return local + offset + drift * (local - anchor);
+  }
+  double ClockSync::remaining(double local) const
+  {
+    double slewed = local > corrected ? (local - corrected) * MAX_SLEW : 0.0;
+    if(slewed >= std::abs(correction))
+      return 0.0;
+    return correction > 0.0 ? correction - slewed : correction + slewed;
+  }
+}
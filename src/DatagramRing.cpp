@@ -0,0 +1,76 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    DatagramRing.cpp
+ * ----------------------------------------------------------------------------
+ */
+#include "DatagramRing.h"
+#include "Error.h"
+namespace wic
+{
+  DatagramRing::DatagramRing(size_t capacity, size_t slotSize)
+  : slotSize(slotSize), mask(capacity - 1), head(0), tail(0)
+  {
+    if(capacity == 0 || (capacity & (capacity - 1)) != 0)
+      throw InvalidArgument("capacity", "a non power of two");
+    if(slotSize == 0)
+      throw InvalidArgument("slotSize", "zero");
+    
+    storage.resize(capacity * slotSize);
+    slots.resize(capacity);
+    for(size_t i = 0; i < capacity; i++)
+    {
+      slots[i].data = &storage[i * slotSize];
+      slots[i].length = 0;
+    }
+  }
+  size_t DatagramRing::getCapacity() const
+  {
+    return mask + 1;
+  }
+  size_t DatagramRing::getSlotSize() const
+  {
+    return slotSize;
+  }
+  size_t DatagramRing::size() const
+  {
+    size_t front = head.load(std::memory_order_acquire);
+    return tail.load(std::memory_order_acquire) - front;
+  }
+  size_t DatagramRing::space() const
+  {
+    return getCapacity() - size();
+  }
+  Datagram& DatagramRing::back(size_t i)
+  {
+    return slots[(tail.load(std::memory_order_relaxed) + i) & mask];
+  }
+  void DatagramRing::push(size_t n)
+  {
+    tail.store(tail.load(std::memory_order_relaxed) + n,
+               std::memory_order_release);
+  }
+  Datagram& DatagramRing::front(size_t i)
+  {
+    return slots[(head.load(std::memory_order_relaxed) + i) & mask];
+  }
+  void DatagramRing::pop(size_t n)
+  {
+    head.store(head.load(std::memory_order_relaxed) + n,
+               std::memory_order_release);
+  }
+}
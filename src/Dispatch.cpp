@@ -0,0 +1,56 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Dispatch.cpp
+ * ----------------------------------------------------------------------------
+ */
+#include "Dispatch.h"
+namespace wic
+{
+  Dispatcher::Entry::Entry()
+  : call(nullptr), function(nullptr), context(nullptr)
+  {
+  }
+  Dispatcher::Dispatcher()
+  : fallback(nullptr), fallbackContext(nullptr)
+  {
+  }
+  void Dispatcher::setDefaultHandler(void (*handler)(const PacketView&, void*),
+                                     void* context)
+  {
+    fallback = handler;
+    fallbackContext = context;
+  }
+  void Dispatcher::removeHandler(uint8_t type)
+  {
+    entries[type] = Entry();
+  }
+  bool Dispatcher::hasHandler(uint8_t type) const
+  {
+    return entries[type].call != nullptr;
+  }
+  size_t Dispatcher::dispatch(const vector<PacketView>& packets) const
+  {
+    size_t handled = 0;
+    for(size_t i = 0; i < packets.size(); i++)
+    {
+      if(dispatch(packets[i]))
+        handled++;
+    }
+    return handled;
+  }
+}
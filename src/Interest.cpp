@@ -0,0 +1,164 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Interest.cpp
+ * ----------------------------------------------------------------------------
+ */
+#include "Interest.h"
+namespace wic
+{
+  InterestGrid::InterestGrid(double cellSize)
+  {
+    if(!(cellSize > 0.0))
+      throw InvalidArgument("cellSize", "<= 0");
+    this->cellSize = cellSize;
+  }
+  void InterestGrid::setView(uint16_t ID, const Bounds& view)
+  {
+    if(ID >= views.size())
+    {
+      views.resize(ID + 1);
+      viewing.resize(ID + 1, false);
+    }
+    if(viewing[ID])
+      unindex(ID);
+    // Bounds has no assignment operator of its own
+    Bounds& stored = views[ID];
+    stored.lowerLeft = view.lowerLeft;
+    stored.upperRight = view.upperRight;
+    viewing[ID] = true;
+    index(ID);
+  }
+  void InterestGrid::removeView(uint16_t ID)
+  {
+    if(!hasView(ID))
+      return;
+    unindex(ID);
+    viewing[ID] = false;
+  }
+  bool InterestGrid::hasView(uint16_t ID) const
+  {
+    return ID < viewing.size() && viewing[ID];
+  }
+  void InterestGrid::query(const Pair& position,
+                           vector<uint16_t>& results) const
+  {
+    results.clear();
+    auto cell = cells.find(key(cellOf(position.x), cellOf(position.y)));
+    const vector<uint16_t>* candidates[2] = {&wide, nullptr};
+    if(cell != cells.end())
+      candidates[1] = &cell->second;
+    for(unsigned i = 0; i < 2 && candidates[i]; i++)
+    {
+      const vector<uint16_t>& IDs = *candidates[i];
+      for(size_t j = 0; j < IDs.size(); j++)
+      {
+        const Bounds& view = views[IDs[j]];
+        if(position.x >= view.lowerLeft.x && position.x <= view.upperRight.x &&
+           position.y >= view.lowerLeft.y && position.y <= view.upperRight.y)
+          results.push_back(IDs[j]);
+      }
+    }
+  }
+  void InterestGrid::setCellSize(double cellSize)
+  {
+    if(!(cellSize > 0.0))
+      throw InvalidArgument("cellSize", "<= 0");
+    cells.clear();
+    wide.clear();
+    this->cellSize = cellSize;
+    for(size_t i = 0; i < views.size(); i++)
+    {
+      if(viewing[i])
+        index(i);
+    }
+  }
+  double InterestGrid::getCellSize() const
+  {
+    return cellSize;
+  }
+  int64_t InterestGrid::cellOf(double coordinate) const
+  {
+    return (int64_t) floor(coordinate / cellSize);
+  }
+  uint64_t InterestGrid::key(int64_t x, int64_t y)
+  {
+    return ((uint64_t) x << 32) ^ ((uint64_t) y & 0xFFFFFFFF);
+  }
+  void InterestGrid::index(uint16_t ID)
+  {
+    const Bounds& view = views[ID];
+    int64_t left = cellOf(view.lowerLeft.x);
+    int64_t right = cellOf(view.upperRight.x);
+    int64_t bottom = cellOf(view.lowerLeft.y);
+    int64_t top = cellOf(view.upperRight.y);
+    if(right < left || top < bottom)
+      return;
+    if((double) (right - left + 1) * (top - bottom + 1) > MAX_CELLS)
+    {
+      wide.push_back(ID);
+      return;
+    }
+    for(int64_t x = left; x <= right; x++)
+    {
+      for(int64_t y = bottom; y <= top; y++)
+        cells[key(x, y)].push_back(ID);
+    }
+  }
+  void InterestGrid::unindex(uint16_t ID)
+  {
+    const Bounds& view = views[ID];
+    int64_t left = cellOf(view.lowerLeft.x);
+    int64_t right = cellOf(view.upperRight.x);
+    int64_t bottom = cellOf(view.lowerLeft.y);
+    int64_t top = cellOf(view.upperRight.y);
+    if(right < left || top < bottom)
+      return;
+    if((double) (right - left + 1) * (top - bottom + 1) > MAX_CELLS)
+    {
+      for(size_t i = 0; i < wide.size(); i++)
+      {
+        if(wide[i] == ID)
+        {
+          wide[i] = wide.back();
+          wide.pop_back();
+          break;
+        }
+      }
+      return;
+    }
+    for(int64_t x = left; x <= right; x++)
+    {
+      for(int64_t y = bottom; y <= top; y++)
+      {
+        auto cell = cells.find(key(x, y));
+        vector<uint16_t>& IDs = cell->second;
+        for(size_t i = 0; i < IDs.size(); i++)
+        {
+          if(IDs[i] == ID)
+          {
+            IDs[i] = IDs.back();
+            IDs.pop_back();
+            break;
+          }
+        }
+        if(IDs.empty())
+          cells.erase(cell);
+      }
+    }
+  }
+}
@@ -19,47 +19,718 @@
  * ----------------------------------------------------------------------------
  */
 #include "Node.h"
+#include "Packet.h"
 namespace wic
 {
+  thread_local vector<uint8_t> Node::pieces;
+  thread_local vector<uint8_t> Node::whole;
+  thread_local uint8_t Node::piecesType;
   Node::Node(string name, unsigned socketPort)
-  : joined(false), ID(0), name(name), maxID(0), sock(0),
-    lenAddr(sizeof(sockaddr_in))
+  : Node(name, checkPort(socketPort), false)
   {
-    if(name.length() > MAX_NAME_LEN)
-      throw InvalidArgument("name", "> " + std::to_string(MAX_NAME_LEN));
-    if(socketPort < 1025)
-      throw InvalidArgument("port", "< 1025");
-    
-    bindSocket(socketPort);
   }
   Node::Node(string name)
+  : Node(name, 0, false)
+  {
+  }
+  Node::Node(string name, unsigned socketPort, bool reusePort)
   : joined(false), ID(0), name(name), maxID(0), sock(0),
-    lenAddr(sizeof(sockaddr_in))
+    lenAddr(sizeof(sockaddr_in)), recvRing(RING_SIZE, MTU), held(0),
+    sendRing(RING_SIZE, MTU), running(false), threaded(false),
+    partial(nullptr), cursor(0), mtu(MTU), nextMessage(0),
+    transport(&socketTransport), capturing(false)
   {
     if(name.length() > MAX_NAME_LEN)
       throw InvalidArgument("name", "> " + std::to_string(MAX_NAME_LEN));
     
-    bindSocket(0);
+    for(uint8_t i = 0; i < CHANNELS; i++)
+      ordered[i] = (i == 0);
+    for(size_t i = 0; i < 256; i++)
+      priorities[i] = 1.0f;
+    bindSocket(socketPort, reusePort);
+  }
+  Node::~Node()
+  {
+    stopIOThread();
+  }
+  void Node::startIOThread()
+  {
+    if(threaded)
+      throw Error("I/O thread already running");
+    running = true;
+    threaded = true;
+    ioThread = std::thread(&Node::ioLoop, this);
+  }
+  void Node::stopIOThread()
+  {
+    if(!threaded)
+      return;
+    running = false;
+    ioThread.join();
+    threaded = false;
+  }
+  void Node::setTransport(Transport* transport)
+  {
+    if(threaded)
+      throw Error("cannot change transport while I/O thread is running");
+    this->transport = transport ? transport : &socketTransport;
+  }
+  bool Node::hasIOThread() const
+  {
+    return threaded;
+  }
+  void Node::startCapture(string path)
+  {
+    std::shared_ptr<CaptureWriter> writer(new CaptureWriter(path));
+    std::atomic_store(&capture, writer);
+    capturing = true;
+  }
+  void Node::stopCapture()
+  {
+    // The file is closed once no thread is still writing to it
+    capturing = false;
+    std::atomic_store(&capture, std::shared_ptr<CaptureWriter>());
+  }
+  bool Node::isCapturing() const
+  {
+    std::shared_ptr<CaptureWriter> writer = std::atomic_load(&capture);
+    return capturing && writer && !writer->hasFailed();
+  }
+  void Node::ioLoop()
+  {
+    Datagram* slots[BATCH_SIZE];
+    Datagram outbound[BATCH_SIZE];
+    bool stopping = false;
+    while(!stopping)
+    {
+      // Read the flag first so that everything queued before a stop request
+      // is transmitted by this final pass.
+      stopping = !running;
+      bool idle = true;
+      
+      // Transmit queued outbound datagrams
+      size_t queued;
+      while((queued = sendRing.size()) > 0)
+      {
+        if(queued > BATCH_SIZE)
+          queued = BATCH_SIZE;
+        for(size_t i = 0; i < queued; i++)
+          outbound[i] = sendRing.front(i);
+        transmit(outbound, queued);
+        sendRing.pop(queued);
+        idle = false;
+      }
+      
+      // Drain the socket into the receive ring
+      size_t space;
+      while((space = recvRing.space()) > 0)
+      {
+        if(space > BATCH_SIZE)
+          space = BATCH_SIZE;
+        for(size_t i = 0; i < space; i++)
+          slots[i] = &recvRing.back(i);
+        size_t received = recvDatagrams(sock, slots, recvRing.getSlotSize(),
+                                        space);
+        recvRing.push(received);
+        if(received == 0)
+          break;
+        idle = false;
+      }
+      
+      // Nothing to do; sleep until data arrives (or briefly, so that outbound
+      // datagrams are never delayed by more than a millisecond)
+      if(idle && !stopping)
+      {
+        struct pollfd fd;
+        fd.fd = sock;
+        fd.events = POLLIN;
+        fd.revents = 0;
+        poll(&fd, 1, 1);
+      }
+    }
+  }
+  unsigned Node::checkPort(unsigned socketPort)
+  {
+    if(socketPort < 1025)
+      throw InvalidArgument("port", "< 1025");
+    return socketPort;
   }
-  void Node::bindSocket(unsigned socketPort)
+  void Node::bindSocket(unsigned socketPort, bool reusePort)
   {
-    sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if(sock == -1)
+    sock = openSocket(socketPort, reusePort);
+  }
+  int Node::openSocket(unsigned socketPort, bool reusePort)
+  {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(fd == -1)
       throw InternalError("socket could not initialize");
-    fcntl(sock, F_SETFL, O_NONBLOCK);
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    if(reusePort)
+    {
+      int one = 1;
+      if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1)
+      {
+        close(fd);
+        throw InternalError("socket could not reuse port");
+      }
+    }
     bzero(&addr, lenAddr);
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
     addr.sin_port = htons(socketPort);
-    int result = bind(sock, (struct sockaddr*) &addr, lenAddr);
+    int result = bind(fd, (struct sockaddr*) &addr, lenAddr);
     if(result == -1)
     {
-      close(sock);
+      close(fd);
       if(errno == EADDRINUSE)
         throw Failure("port already in use");
       else
         throw InternalError("socket could not bind");
     }
+    return fd;
+  }
+  size_t Node::recvDatagrams(int fd, Datagram* const* datagrams,
+                             size_t bufferSize, size_t max)
+  {
+    size_t received = transport->recv(fd, datagrams, bufferSize, max);
+    NetClock::time_point now = NetClock::now();
+    for(size_t i = 0; i < received; i++)
+      datagrams[i]->time = now;
+    if(capturing && received > 0)
+    {
+      std::shared_ptr<CaptureWriter> writer = std::atomic_load(&capture);
+      for(size_t i = 0; writer && i < received; i++)
+        writer->write(CaptureWriter::RECEIVED, *datagrams[i]);
+    }
+    return received;
+  }
+  void Node::sendDatagrams(const Datagram* datagrams, size_t count) const
+  {
+    if(!threaded)
+    {
+      transmit(datagrams, count);
+      return;
+    }
+    // Hand the datagrams to the I/O thread. The ring takes one producer at
+    // a time.
+    std::lock_guard<std::mutex> lock(sendMutex);
+    for(size_t i = 0; i < count && sendRing.space() > 0; i++)
+    {
+      Datagram& slot = sendRing.back(0);
+      slot.length = datagrams[i].length;
+      if(slot.length > sendRing.getSlotSize())
+        slot.length = sendRing.getSlotSize();
+      memcpy(slot.data, datagrams[i].data, slot.length);
+      slot.addr = datagrams[i].addr;
+      sendRing.push(1);
+    }
+  }
+  void Node::sendDatagram(uint8_t* data, size_t length,
+                          const struct sockaddr_in& destAddr) const
+  {
+    Datagram datagram;
+    datagram.data = data;
+    datagram.length = length;
+    datagram.addr = destAddr;
+    sendDatagrams(&datagram, 1);
+  }
+  void Node::transmit(const Datagram* datagrams, size_t count) const
+  {
+    if(capturing)
+    {
+      std::shared_ptr<CaptureWriter> writer = std::atomic_load(&capture);
+      for(size_t i = 0; writer && i < count; i++)
+        writer->write(CaptureWriter::SENT, datagrams[i]);
+    }
+    transport->send(sock, datagrams, count);
+  }
+  size_t Node::receive(size_t max)
+  {
+    recvRing.pop(held);
+    
+    // Without an I/O thread, fill the ring from the socket here
+    if(!threaded)
+    {
+      Datagram* slots[BATCH_SIZE];
+      size_t wanted = 0;
+      if(max > recvRing.size())
+        wanted = max - recvRing.size();
+      if(wanted > recvRing.space())
+        wanted = recvRing.space();
+      while(wanted > 0)
+      {
+        size_t chunk = wanted;
+        if(chunk > BATCH_SIZE)
+          chunk = BATCH_SIZE;
+        for(size_t i = 0; i < chunk; i++)
+          slots[i] = &recvRing.back(i);
+        size_t received = recvDatagrams(sock, slots, recvRing.getSlotSize(),
+                                        chunk);
+        recvRing.push(received);
+        wanted -= received;
+        if(received < chunk)
+          break;
+      }
+    }
+    
+    held = recvRing.size();
+    if(held > max)
+      held = max;
+    return held;
+  }
+  Datagram* Node::nextDatagram(bool& unknown)
+  {
+    if(receive(1) == 0)
+      return nullptr;
+    Datagram& datagram = recvRing.front(0);
+    if(!process(datagram, 0))
+    {
+      unknown = true;
+      return nullptr;
+    }
+    return &datagram;
+  }
+  size_t Node::gather(vector<PacketView>& results, size_t max)
+  {
+    size_t received = receive(max);
+    size_t count = 0;
+    for(size_t i = 0; i < received; i++)
+    {
+      // Datagrams from unknown sources are dropped rather than thrown so
+      // that the remainder of the batch is not lost.
+      Datagram& datagram = recvRing.front(i);
+      if(process(datagram, 0))
+        count = unpack(datagram, 0, results, count);
+    }
+    return count;
+  }
+  bool Node::recvPacket(MysteryPacket& result, bool& unknown)
+  {
+    // Move on once every packet in the current datagram has been read
+    while(partial == nullptr || cursor >= partial->length)
+    {
+      partial = nextDatagram(unknown);
+      if(partial == nullptr && takeReleased())
+        partial = &deliveringDatagram;
+      cursor = 0;
+      if(partial == nullptr)
+        return false;
+    }
+    PacketView view(partial->data + cursor);
+    cursor += view.getLength();
+    result.populate(view);
+    return true;
+  }
+  size_t Node::recvViews(vector<PacketView>& results, size_t max)
+  {
+    size_t count;
+    if(partial != nullptr && cursor < partial->length)
+      count = unpack(*partial, cursor, results, 0);
+    else
+    {
+      count = gather(results, max);
+      count = unpackReleased(results, count);
+    }
+    partial = nullptr;
+    results.resize(count);
+    return count;
+  }
+  size_t Node::unpack(const Datagram& datagram, size_t offset,
+                      vector<PacketView>& results, size_t count) const
+  {
+    // Processed datagrams hold nothing but complete packets
+    while(offset < datagram.length)
+    {
+      PacketView view(datagram.data + offset);
+      if(count < results.size())
+        results[count] = view;
+      else
+        results.push_back(view);
+      count++;
+      offset += view.getLength();
+    }
+    return count;
+  }
+  size_t Node::unpackReleased(vector<PacketView>& results, size_t count)
+  {
+    if(!takeReleased())
+      return count;
+    return unpack(deliveringDatagram, 0, results, count);
+  }
+  Node::Peer::Peer()
+  : listed(false), linked(false), budget(0), tokens(0.0), throttled(false)
+  {
+  }
+  Node::Peer& Node::getPeer(size_t slot)
+  {
+    if(slot >= peers.size())
+      peers.resize(slot + 1);
+    return peers[slot];
+  }
+  void Node::coalesce(const uint8_t* bytes, size_t length, size_t slot,
+                      const struct sockaddr_in& destAddr)
+  {
+    Peer& peer = getPeer(slot);
+    if(peer.data.size() + length > mtu)
+      flush(slot);
+    if(peer.data.empty())
+    {
+      peer.data.reserve(mtu);
+      peer.addr = destAddr;
+    }
+    if(!peer.listed)
+    {
+      peer.listed = true;
+      dirty.push_back(slot);
+    }
+    peer.data.insert(peer.data.end(), bytes, bytes + length);
+  }
+  void Node::flush(size_t slot)
+  {
+    if(slot >= peers.size() || peers[slot].data.empty())
+      return;
+    Peer& peer = peers[slot];
+    sendDatagram(peer.data.data(), peer.data.size(), peer.addr);
+    peer.data.clear();
+  }
+  void Node::flushAll()
+  {
+    // Reliable traffic goes first, sharing datagrams with everything else
+    NetClock::time_point now = NetClock::now();
+    uint8_t bytes[MTU];
+    size_t kept = 0;
+    for(size_t i = 0; i < linkedPeers.size(); i++)
+    {
+      size_t slot = linkedPeers[i];
+      Peer& peer = peers[slot];
+      size_t length;
+      while((length = peer.reliable->emit(now, ID, bytes, mtu)) > 0)
+      {
+        coalesce(bytes, length, slot, peer.addr);
+        if(peer.budget > 0)
+        {
+          refill(peer, now);
+          peer.tokens -= length;
+        }
+      }
+      if(peer.reliable->isIdle())
+        peer.linked = false;
+      else
+        linkedPeers[kept++] = slot;
+    }
+    linkedPeers.resize(kept);
+    
+    // Then whatever fits within each limited peer's budget
+    kept = 0;
+    for(size_t i = 0; i < throttled.size(); i++)
+    {
+      size_t slot = throttled[i];
+      schedule(slot, now);
+      if(peers[slot].deferred.empty())
+        peers[slot].throttled = false;
+      else
+        throttled[kept++] = slot;
+    }
+    throttled.resize(kept);
+    
+    Datagram datagrams[BATCH_SIZE];
+    size_t count = 0;
+    for(size_t i = 0; i < dirty.size(); i++)
+    {
+      // Peers flushed individually since being listed may be empty
+      Peer& peer = peers[dirty[i]];
+      if(peer.data.empty())
+        continue;
+      datagrams[count].data = peer.data.data();
+      datagrams[count].length = peer.data.size();
+      datagrams[count].addr = peer.addr;
+      if(++count == BATCH_SIZE)
+      {
+        sendDatagrams(datagrams, count);
+        count = 0;
+      }
+    }
+    if(count > 0)
+      sendDatagrams(datagrams, count);
+    for(size_t i = 0; i < dirty.size(); i++)
+    {
+      peers[dirty[i]].data.clear();
+      peers[dirty[i]].listed = false;
+    }
+    dirty.clear();
+  }
+  void Node::refill(Peer& peer, NetClock::time_point now)
+  {
+    // At most a tenth of a second's worth (and at least a full datagram)
+    // accumulates while idle
+    double elapsed = std::chrono::duration<double>(now - peer.refilled)
+                     .count();
+    double cap = peer.budget / 10.0 > mtu ? peer.budget / 10.0 : mtu;
+    peer.tokens += elapsed * peer.budget;
+    if(peer.tokens > cap)
+      peer.tokens = cap;
+    peer.refilled = now;
+  }
+  void Node::schedule(size_t slot, NetClock::time_point now)
+  {
+    Peer& peer = peers[slot];
+    refill(peer, now);
+    
+    // Send by priority, oldest first among equals, while budget remains.
+    // An entry may overdraw the budget; the debt delays later entries.
+    order.resize(peer.deferred.size());
+    for(size_t i = 0; i < order.size(); i++)
+      order[i] = i;
+    const vector<Deferred>& deferred = peer.deferred;
+    std::stable_sort(order.begin(), order.end(),
+                     [&deferred](size_t a, size_t b)
+                     {
+                       return deferred[a].priority > deferred[b].priority;
+                     });
+    size_t sent = 0;
+    for(; sent < order.size() && peer.tokens > 0.0; sent++)
+    {
+      const Deferred& entry = peer.deferred[order[sent]];
+      const uint8_t* bytes = peer.deferredData.data() + entry.offset;
+      for(size_t offset = 0; offset < entry.length;)
+      {
+        size_t length = PacketView(bytes + offset).getLength();
+        coalesce(bytes + offset, length, slot, peer.addr);
+        offset += length;
+      }
+      peer.tokens -= entry.length;
+    }
+    
+    // Drop the lowest-priority entries beyond the limit, then keep the rest
+    // in their original order with their priorities raised
+    size_t remaining = 0;
+    for(size_t i = sent; i < order.size(); i++)
+      remaining += peer.deferred[order[i]].length;
+    size_t end = order.size();
+    while(end > sent && remaining > MAX_DEFERRED)
+      remaining -= peer.deferred[order[--end]].length;
+    for(size_t i = 0; i < sent; i++)
+      peer.deferred[order[i]].length = 0;
+    for(size_t i = end; i < order.size(); i++)
+      peer.deferred[order[i]].length = 0;
+    keptData.clear();
+    size_t count = 0;
+    for(size_t i = 0; i < peer.deferred.size(); i++)
+    {
+      Deferred entry = peer.deferred[i];
+      if(entry.length == 0)
+        continue;
+      const uint8_t* bytes = peer.deferredData.data() + entry.offset;
+      entry.offset = keptData.size();
+      entry.priority += entry.increment;
+      keptData.insert(keptData.end(), bytes, bytes + entry.length);
+      peer.deferred[count++] = entry;
+    }
+    peer.deferred.resize(count);
+    peer.deferredData.swap(keptData);
+  }
+  void Node::setBudget(size_t slot, size_t bytesPerSecond)
+  {
+    Peer& peer = getPeer(slot);
+    if(bytesPerSecond == 0 && peer.budget > 0)
+    {
+      // Release everything held back
+      for(size_t i = 0; i < peer.deferred.size(); i++)
+      {
+        const Deferred& entry = peer.deferred[i];
+        const uint8_t* bytes = peer.deferredData.data() + entry.offset;
+        for(size_t offset = 0; offset < entry.length;)
+        {
+          size_t length = PacketView(bytes + offset).getLength();
+          coalesce(bytes + offset, length, slot, peer.addr);
+          offset += length;
+        }
+      }
+      peer.deferred.clear();
+      peer.deferredData.clear();
+    }
+    if(peer.budget == 0)
+    {
+      peer.tokens = 0.0;
+      peer.refilled = NetClock::now();
+    }
+    peer.budget = bytesPerSecond;
+  }
+  void Node::link(size_t slot)
+  {
+    Peer& peer = getPeer(slot);
+    if(!peer.reliable)
+      peer.reliable.reset(new ReliableEndpoint());
+    if(!peer.linked)
+    {
+      peer.linked = true;
+      linkedPeers.push_back(slot);
+    }
+  }
+  size_t Node::fragment(const AbstractPacket& packet, NodeID source,
+                        size_t limit) const
+  {
+    size_t total = AbstractPacket::HEADER_SIZE + packet.getSize();
+    piecesType = packet.getType();
+    if(total <= limit)
+    {
+      pieces.resize(total);
+      packet.toBuffer(pieces.data(), source);
+      return 1;
+    }
+    
+    // Every piece but the last carries the same number of bytes
+    whole.resize(total);
+    packet.toBuffer(whole.data(), source);
+    size_t chunk = limit - AbstractPacket::HEADER_SIZE - Fragment::SIZE;
+    size_t count = (total + chunk - 1) / chunk;
+    pieces.resize(count * (AbstractPacket::HEADER_SIZE + Fragment::SIZE) +
+                  total);
+    size_t filled = 0;
+    uint16_t message = nextMessage++;
+    for(size_t i = 0; i < count; i++)
+    {
+      size_t length = (i == count - 1) ? total - i * chunk : chunk;
+      Fragment piece(message, i, count, total, whole.data() + i * chunk,
+                     length);
+      piece.toBuffer(pieces.data() + filled, source);
+      filled += AbstractPacket::HEADER_SIZE + piece.getSize();
+    }
+    return count;
+  }
+  void Node::sendPieces(size_t count, const struct sockaddr_in& destAddr) const
+  {
+    Datagram datagrams[BATCH_SIZE];
+    size_t batched = 0;
+    size_t offset = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+      datagrams[batched].data = pieces.data() + offset;
+      datagrams[batched].length = PacketView(pieces.data() + offset)
+                                  .getLength();
+      datagrams[batched].addr = destAddr;
+      offset += datagrams[batched].length;
+      if(++batched == BATCH_SIZE)
+      {
+        sendDatagrams(datagrams, batched);
+        batched = 0;
+      }
+    }
+    if(batched > 0)
+      sendDatagrams(datagrams, batched);
+  }
+  void Node::queuePieces(size_t count, size_t slot,
+                         const struct sockaddr_in& destAddr)
+  {
+    Peer& peer = getPeer(slot);
+    if(peer.budget > 0)
+    {
+      // Hold the pieces back as one entry, to be scheduled by flushAll
+      size_t length = 0;
+      for(size_t i = 0; i < count; i++)
+        length += PacketView(pieces.data() + length).getLength();
+      Deferred entry;
+      entry.offset = peer.deferredData.size();
+      entry.length = length;
+      entry.priority = priorities[piecesType];
+      entry.increment = priorities[piecesType];
+      peer.deferred.push_back(entry);
+      peer.deferredData.insert(peer.deferredData.end(), pieces.data(),
+                               pieces.data() + length);
+      peer.addr = destAddr;
+      if(!peer.throttled)
+      {
+        peer.throttled = true;
+        throttled.push_back(slot);
+      }
+      return;
+    }
+    size_t offset = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+      size_t length = PacketView(pieces.data() + offset).getLength();
+      coalesce(pieces.data() + offset, length, slot, destAddr);
+      offset += length;
+    }
+  }
+  void Node::enqueueReliable(const AbstractPacket& packet, NodeID source,
+                             uint8_t channel, size_t slot,
+                             const struct sockaddr_in& destAddr)
+  {
+    if(channel >= CHANNELS)
+      throw InvalidArgument("channel", ">= CHANNELS");
+    size_t count = fragment(packet, source, mtu - ReliableEndpoint::OVERHEAD);
+    link(slot);
+    Peer& peer = peers[slot];
+    peer.addr = destAddr;
+    size_t offset = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+      size_t length = PacketView(pieces.data() + offset).getLength();
+      if(!peer.reliable->push(pieces.data() + offset, length, channel,
+                              ordered[channel]))
+        throw Failure("reliable backlog full");
+      offset += length;
+    }
+  }
+  void Node::transmitReliable(size_t slot)
+  {
+    if(slot >= peers.size() || !peers[slot].reliable)
+      return;
+    Peer& peer = peers[slot];
+    NetClock::time_point now = NetClock::now();
+    uint8_t bytes[MTU];
+    size_t length;
+    while((length = peer.reliable->emit(now, ID, bytes, mtu)) > 0)
+      coalesce(bytes, length, slot, peer.addr);
+    flush(slot);
+  }
+  bool Node::unwrap(const PacketView& envelope, size_t slot,
+                    const struct sockaddr_in& srcAddr, vector<uint8_t>& out)
+  {
+    out.clear();
+    link(slot);
+    Peer& peer = peers[slot];
+    peer.addr = srcAddr;
+    return peer.reliable->receive(envelope, NetClock::now(), out);
+  }
+  void Node::acknowledge(const PacketView& ack, size_t slot)
+  {
+    if(slot < peers.size() && peers[slot].reliable)
+      peers[slot].reliable->acknowledge(ack, NetClock::now());
+  }
+  const vector<uint8_t>* Node::reassemble(const PacketView& fragment,
+                                          size_t slot)
+  {
+    return reassembler.add(fragment, slot, NetClock::now());
+  }
+  void Node::resetPeer(size_t slot)
+  {
+    reassembler.forget(slot);
+    if(slot >= peers.size())
+      return;
+    peers[slot].data.clear();
+    peers[slot].deferred.clear();
+    peers[slot].deferredData.clear();
+    peers[slot].budget = 0;
+    if(peers[slot].reliable)
+      peers[slot].reliable->reset();
+  }
+  void Node::release(const uint8_t* bytes, size_t length)
+  {
+    std::lock_guard<std::mutex> lock(releasedMutex);
+    released.insert(released.end(), bytes, bytes + length);
+  }
+  bool Node::takeReleased()
+  {
+    {
+      std::lock_guard<std::mutex> lock(releasedMutex);
+      delivering.swap(released);
+      released.clear();
+    }
+    deliveringDatagram.data = delivering.data();
+    deliveringDatagram.length = delivering.size();
+    return !delivering.empty();
   }
   NodeID Node::getID() const
   {
@@ -73,7 +744,7 @@ namespace wic
   {
     return maxID;
   }
-  uint8_t Node::getMaxNodes() const
+  unsigned Node::getMaxNodes() const
   {
     return 1 + maxID;
   }
@@ -87,6 +758,57 @@ namespace wic
   {
     return names[ID];
   }
+  void Node::setMTU(size_t mtu)
+  {
+    if(mtu < 64)
+      throw InvalidArgument("mtu", "< 64");
+    if(mtu > MTU)
+      throw InvalidArgument("mtu", "> MTU");
+    
+    // Reliable packets are already cut to fit the old size, and one that no
+    // longer fits a datagram would hold up its channel forever
+    for(size_t slot = 0; slot < peers.size(); slot++)
+    {
+      const Peer& peer = peers[slot];
+      if(peer.reliable &&
+         peer.reliable->getLargest() + ReliableEndpoint::OVERHEAD > mtu)
+        throw InvalidArgument("mtu", "< a reliable packet in flight");
+    }
+    flushAll();
+    this->mtu = mtu;
+  }
+  size_t Node::getMTU() const
+  {
+    return mtu;
+  }
+  void Node::setReassemblyLimits(size_t maxBytes, double timeout)
+  {
+    reassembler.setLimits(maxBytes, timeout);
+  }
+  void Node::setPriority(uint8_t type, float priority)
+  {
+    if(!(priority > 0.0f))
+      throw InvalidArgument("priority", "<= 0");
+    priorities[type] = priority;
+  }
+  float Node::getPriority(uint8_t type) const
+  {
+    return priorities[type];
+  }
+  void Node::setOrdered(uint8_t channel, bool ordered)
+  {
+    if(channel == 0)
+      throw InvalidArgument("channel", "zero");
+    if(channel >= CHANNELS)
+      throw InvalidArgument("channel", ">= CHANNELS");
+    this->ordered[channel] = ordered;
+  }
+  bool Node::isOrdered(uint8_t channel) const
+  {
+    if(channel >= CHANNELS)
+      throw InvalidArgument("channel", ">= CHANNELS");
+    return ordered[channel];
+  }
   const uint8_t Node::MAX_NAME_LEN = 20;
 
 }
@@ -21,13 +21,45 @@
 #include "Packet.h"
 namespace wic
 {
-  const size_t AbstractPacket::HEADER_SIZE = 3*sizeof(uint8_t);
+  const size_t AbstractPacket::HEADER_SIZE = 6;
+  const uint8_t AbstractPacket::VERSION = 1;
+  PacketView::PacketView()
+  : datagram(nullptr)
+  {
+  }
+  PacketView::PacketView(const uint8_t* datagram)
+  : datagram(datagram)
+  {
+  }
+  bool PacketView::isValid(const uint8_t* datagram, size_t length)
+  {
+    return length >= AbstractPacket::HEADER_SIZE &&
+           datagram[0] == AbstractPacket::VERSION &&
+           length >= AbstractPacket::HEADER_SIZE + U16::read(&datagram[4]);
+  }
+  uint8_t PacketView::getType() const   { return datagram[1]; }
+  NodeID PacketView::getSource() const  { return U16::read(&datagram[2]); }
+  uint16_t PacketView::getSize() const  { return U16::read(&datagram[4]); }
+  size_t PacketView::getLength() const
+  {
+    return AbstractPacket::HEADER_SIZE + getSize();
+  }
+  const uint8_t* PacketView::getBytes() const
+  {
+    return datagram + AbstractPacket::HEADER_SIZE;
+  }
+  
   AbstractPacket::AbstractPacket()
+  : view(nullptr)
   {
   }
   vector<uint8_t> AbstractPacket::getData() const
   {
-    return data;
+    return vector<uint8_t>(getBytes(), getBytes() + getSize());
+  }
+  const uint8_t* AbstractPacket::getBytes() const
+  {
+    return view ? view : data.data();
   }
   NodeID AbstractPacket::getSource() const
   {
@@ -37,70 +69,92 @@ namespace wic
   {
     if(dest == nullptr)
       throw InvalidArgument("dest", "null");
-    dest[0] = getType();
-    dest[1] = source;
-    dest[2] = getSize();
-    memcpy(dest + HEADER_SIZE, &data[0], getSize());
+    dest[0] = VERSION;
+    dest[1] = getType();
+    U16::write(&dest[2], source);
+    U16::write(&dest[4], getSize());
+    memcpy(dest + HEADER_SIZE, getBytes(), getSize());
+  }
+  size_t AbstractPacket::toBuffer(uint8_t* dest, size_t capacity,
+                                  NodeID source) const
+  {
+    size_t length = HEADER_SIZE + getSize();
+    if(length > capacity)
+      throw InvalidArgument("packet", "larger than capacity");
+    toBuffer(dest, source);
+    return length;
   }
   void MysteryPacket::populate(uint8_t* src)
   {
     if(src == nullptr)
       throw InvalidArgument("src", "null");
-    type_ = src[0];
-    source = src[1];
-    size_ = src[2];
-    data.resize(size_);
-    memcpy(&data[0], &src[3], size_);
+    populate(PacketView(src));
   }
   void MysteryPacket::populate(const AbstractPacket& other)
   {
     type_ = other.getType();
     source = other.getSource();
     size_ = other.getSize();
-    data = other.getData();
+    data.assign(other.getBytes(), other.getBytes() + size_);
+    view = nullptr;
+  }
+  void MysteryPacket::populate(const PacketView& view)
+  {
+    type_ = view.getType();
+    source = view.getSource();
+    size_ = view.getSize();
+    data.assign(view.getBytes(), view.getBytes() + size_);
+    this->view = nullptr;
   }
   uint8_t MysteryPacket::getType() const { return type_; }
-  uint8_t MysteryPacket::getSize() const { return size_; }
+  uint16_t MysteryPacket::getSize() const { return size_; }
   
   JoinRequest::JoinRequest(string name)
   {
-    memcpy(&data[0], name.data(), name.size()+1);
+    Layout::encode(data.data(), name);
   }
-  string JoinRequest::name()  { return string((char*) data.data()); }
+  TextView JoinRequest::name() const { return Layout::get<0>(getBytes()); }
   
   JoinResponse::JoinResponse(uint8_t responseCode, NodeID maxID,
                               NodeID assignedID, string serverName)
   {
-    data[0] = responseCode;
-    data[1] = maxID;
-    data[2] = assignedID;
-    memcpy(&data[3], serverName.data(), serverName.size()+1);
-  }
-  bool JoinResponse::ok() const           { return (data[0] == OK); }
-  bool JoinResponse::full() const         { return (data[0] == FULL); }
-  bool JoinResponse::banned() const       { return (data[0] == BANNED); }
-  uint8_t JoinResponse::maxID() const     { return data[1]; }
-  NodeID JoinResponse::assignedID() const { return data[2]; }
-  string JoinResponse::serverName() const { return string((char*) &data[3]); }
+    Layout::encode(data.data(), responseCode, maxID, assignedID, serverName);
+  }
+  bool JoinResponse::ok() const
+  {
+    return Layout::get<0>(getBytes()) == OK;
+  }
+  bool JoinResponse::full() const
+  {
+    return Layout::get<0>(getBytes()) == FULL;
+  }
+  bool JoinResponse::banned() const
+  {
+    return Layout::get<0>(getBytes()) == BANNED;
+  }
+  NodeID JoinResponse::maxID() const      { return Layout::get<1>(getBytes()); }
+  NodeID JoinResponse::assignedID() const { return Layout::get<2>(getBytes()); }
+  TextView JoinResponse::serverName() const
+  {
+    return Layout::get<3>(getBytes());
+  }
   const uint8_t JoinResponse::OK = 0;
   const uint8_t JoinResponse::FULL = 1;
   const uint8_t JoinResponse::BANNED = 2;
   
   ClientJoined::ClientJoined(NodeID newID, string newName)
   {
-    data[0] = newID;
-    memcpy(&data[1], newName.data(), newName.size()+1);
+    Layout::encode(data.data(), newID, newName);
   }
-  NodeID ClientJoined::newID() const   { return data[0]; }
-  string ClientJoined::newName() const { return string((char*) &data[1]); }
+  NodeID ClientJoined::newID() const     { return Layout::get<0>(getBytes()); }
+  TextView ClientJoined::newName() const { return Layout::get<1>(getBytes()); }
   
   ClientInfo::ClientInfo(NodeID ID, string name)
   {
-    data[0] = ID;
-    memcpy(&data[1], name.data(), name.size()+1);
+    Layout::encode(data.data(), ID, name);
   }
-  NodeID ClientInfo::ID() const   { return data[0]; }
-  string ClientInfo::name() const { return string((char*) &data[1]); }
+  NodeID ClientInfo::ID() const     { return Layout::get<0>(getBytes()); }
+  TextView ClientInfo::name() const { return Layout::get<1>(getBytes()); }
   
   Leaving::Leaving()
   {
@@ -108,32 +162,188 @@ namespace wic
   
   Kick::Kick(string reason)
   {
-    memcpy(&data[0], reason.data(), reason.size()+1);
+    Layout::encode(data.data(), reason);
   }
-  string Kick::reason() const  { return string((char*) &data[0]); }
+  TextView Kick::reason() const { return Layout::get<0>(getBytes()); }
   
   Ban::Ban(string reason)
   {
-    memcpy(&data[0], reason.data(), reason.size() + 1);
+    Layout::encode(data.data(), reason);
   }
-  string Ban::reason() const  { return string((char*) data.data()); }
+  TextView Ban::reason() const { return Layout::get<0>(getBytes()); }
   
   ClientLeft::ClientLeft(NodeID oldID, uint8_t leaveCode, string reason)
   {
-    data[0] = oldID;
-    data[1] = leaveCode;
-    memcpy(&data[2], reason.data(), reason.size()+1);
+    Layout::encode(data.data(), oldID, leaveCode, reason);
+  }
+  NodeID ClientLeft::oldID() const  { return Layout::get<0>(getBytes()); }
+  bool ClientLeft::normal() const
+  {
+    return Layout::get<1>(getBytes()) == NORMAL;
+  }
+  bool ClientLeft::kicked() const
+  {
+    return Layout::get<1>(getBytes()) == KICKED;
+  }
+  bool ClientLeft::banned() const
+  {
+    return Layout::get<1>(getBytes()) == BANNED;
+  }
+  bool ClientLeft::timedOut() const
+  {
+    return Layout::get<1>(getBytes()) == TIMED_OUT;
   }
-  NodeID ClientLeft::oldID() const  { return data[0]; }
-  bool ClientLeft::normal() const   { return (data[1] == NORMAL); }
-  bool ClientLeft::kicked() const   { return (data[1] == KICKED); }
-  bool ClientLeft::banned() const   { return (data[1] == BANNED); }
-  string ClientLeft::reason() const { return string((char*) &data.data()[2]); }
+  TextView ClientLeft::reason() const { return Layout::get<2>(getBytes()); }
   const uint8_t ClientLeft::NORMAL = 0;
   const uint8_t ClientLeft::KICKED = 1;
   const uint8_t ClientLeft::BANNED = 2;
+  const uint8_t ClientLeft::TIMED_OUT = 3;
   
   Shutdown::Shutdown()
   {
   }
+  
+  Snapshot::Snapshot(uint32_t tick, uint32_t baseTick, const uint8_t* delta,
+                     size_t length)
+  {
+    if(SIZE + length > 65535)
+      throw InvalidArgument("length", "> 65527");
+    setSize(SIZE + length);
+    Layout::encode(data.data(), tick, baseTick);
+    memcpy(data.data() + SIZE, delta, length);
+  }
+  uint32_t Snapshot::tick() const        { return Layout::get<0>(getBytes()); }
+  uint32_t Snapshot::baseTick() const    { return Layout::get<1>(getBytes()); }
+  const uint8_t* Snapshot::delta() const { return &getBytes()[SIZE]; }
+  size_t Snapshot::deltaLength() const   { return getSize() - SIZE; }
+  
+  SnapshotAck::SnapshotAck(uint32_t tick)
+  {
+    Layout::encode(data.data(), tick);
+  }
+  uint32_t SnapshotAck::tick() const { return Layout::get<0>(getBytes()); }
+  
+  Reliable::Reliable(uint8_t flags, uint16_t sequence, uint16_t order,
+                     uint16_t ack, uint32_t ackBits, const uint8_t* packet,
+                     size_t length)
+  {
+    if(SIZE + length > 65535)
+      throw InvalidArgument("length", "> 65524");
+    setSize(SIZE + length);
+    Layout::encode(data.data(), flags, sequence, order, ack, ackBits);
+    memcpy(data.data() + SIZE, packet, length);
+  }
+  uint8_t Reliable::channel() const
+  {
+    return Layout::get<0>(getBytes()) & 0x3F;
+  }
+  bool Reliable::ordered() const
+  {
+    return Layout::get<0>(getBytes()) & ORDERED;
+  }
+  bool Reliable::hasAck() const
+  {
+    return Layout::get<0>(getBytes()) & HAS_ACK;
+  }
+  uint16_t Reliable::sequence() const { return Layout::get<1>(getBytes()); }
+  uint16_t Reliable::order() const    { return Layout::get<2>(getBytes()); }
+  uint16_t Reliable::ack() const      { return Layout::get<3>(getBytes()); }
+  uint32_t Reliable::ackBits() const  { return Layout::get<4>(getBytes()); }
+  const uint8_t* Reliable::packet() const { return &getBytes()[SIZE]; }
+  size_t Reliable::packetLength() const { return getSize() - SIZE; }
+  
+  Ack::Ack(uint16_t ack, uint32_t ackBits)
+  {
+    Layout::encode(data.data(), ack, ackBits);
+  }
+  uint16_t Ack::ack() const     { return Layout::get<0>(getBytes()); }
+  uint32_t Ack::ackBits() const { return Layout::get<1>(getBytes()); }
+  
+  Fragment::Fragment(uint16_t message, uint16_t index, uint16_t count,
+                     uint32_t total, const uint8_t* bytes, size_t length)
+  {
+    if(SIZE + length > 65535)
+      throw InvalidArgument("length", "> 65525");
+    setSize(SIZE + length);
+    Layout::encode(data.data(), message, index, count, total);
+    memcpy(data.data() + SIZE, bytes, length);
+  }
+  uint16_t Fragment::message() const     { return Layout::get<0>(getBytes()); }
+  uint16_t Fragment::index() const       { return Layout::get<1>(getBytes()); }
+  uint16_t Fragment::count() const       { return Layout::get<2>(getBytes()); }
+  uint32_t Fragment::total() const       { return Layout::get<3>(getBytes()); }
+  const uint8_t* Fragment::bytes() const { return &getBytes()[SIZE]; }
+  size_t Fragment::length() const        { return getSize() - SIZE; }
+  
+  Heartbeat::Heartbeat()
+  {
+  }
+  
+  Roster::Roster()
+  {
+    Layout::encode(data.data(), (uint16_t) 0);
+  }
+  bool Roster::add(NodeID ID, string name)
+  {
+    if(name.length() > 20)
+      throw InvalidArgument("name", "> 20 characters");
+    size_t offset = getSize();
+    if(offset + 3 + name.length() > 65535)
+      return false;
+    setSize(offset + 3 + name.length());
+    U16::write(&data[offset], ID);
+    data[offset + 2] = name.length();
+    memcpy(&data[offset + 3], name.data(), name.length());
+    Layout::set<0>(data.data(), (uint16_t) (count() + 1));
+    return true;
+  }
+  uint16_t Roster::count() const { return Layout::get<0>(getBytes()); }
+  vector<NodeID> Roster::IDs() const
+  {
+    vector<NodeID> result;
+    const uint8_t* bytes = getBytes();
+    for(size_t offset = SIZE;
+        offset + 3 <= getSize() && offset + 3 + bytes[offset + 2] <= getSize();
+        offset += 3 + bytes[offset + 2])
+      result.push_back(U16::read(&bytes[offset]));
+    return result;
+  }
+  vector<string> Roster::names() const
+  {
+    vector<string> result;
+    const uint8_t* bytes = getBytes();
+    for(size_t offset = SIZE;
+        offset + 3 <= getSize() && offset + 3 + bytes[offset + 2] <= getSize();
+        offset += 3 + bytes[offset + 2])
+      result.push_back(string((const char*) &bytes[offset + 3],
+                              bytes[offset + 2]));
+    return result;
+  }
+  
+  TimeRequest::TimeRequest(uint64_t clientTime)
+  {
+    Layout::encode(data.data(), clientTime);
+  }
+  uint64_t TimeRequest::clientTime() const
+  {
+    return Layout::get<0>(getBytes());
+  }
+  
+  TimeResponse::TimeResponse(uint64_t clientTime, uint64_t serverReceived,
+                             uint64_t serverSent)
+  {
+    Layout::encode(data.data(), clientTime, serverReceived, serverSent);
+  }
+  uint64_t TimeResponse::clientTime() const
+  {
+    return Layout::get<0>(getBytes());
+  }
+  uint64_t TimeResponse::serverReceived() const
+  {
+    return Layout::get<1>(getBytes());
+  }
+  uint64_t TimeResponse::serverSent() const
+  {
+    return Layout::get<2>(getBytes());
+  }
 }
@@ -37,6 +37,12 @@ namespace wic
   : Pair(other.x, other.y)
   {
   }
+  Pair& Pair::operator=(const Pair& other)
+  {
+    x = other.x;
+    y = other.y;
+    return *this;
+  }
   double Pair::distance(const Pair& other) const 
   {
     return(std::sqrt(pow(other.x - x, 2.0) + pow(other.y - y, 2.0)));
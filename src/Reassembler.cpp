@@ -0,0 +1,154 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Reassembler.cpp
+ * ----------------------------------------------------------------------------
+ */
+#include "Reassembler.h"
+#include "Packet.h"
+namespace wic
+{
+  Reassembler::Message::Message()
+  : active(false), slot(0), id(0), count(0), received(0)
+  {
+  }
+  Reassembler::Reassembler()
+  : pending(0), maxBytes(1 << 22), timeout(5.0)
+  {
+  }
+  void Reassembler::setLimits(size_t maxBytes, double timeout)
+  {
+    if(timeout <= 0.0)
+      throw InvalidArgument("timeout", "<= 0");
+    this->maxBytes = maxBytes;
+    this->timeout = timeout;
+    for(size_t i = 0; i < messages.size(); i++)
+    {
+      if(messages[i].active && pending > maxBytes)
+        drop(messages[i]);
+    }
+  }
+  const vector<uint8_t>* Reassembler::add(const PacketView& fragment,
+                                          size_t slot,
+                                          NetClock::time_point now)
+  {
+    if(fragment.getSize() < Fragment::SIZE)
+      return nullptr;
+    Fragment piece(fragment);
+    size_t total = piece.total();
+    size_t length = piece.length();
+    uint16_t count = piece.count();
+    uint16_t index = piece.index();
+    if(index >= count || total < AbstractPacket::HEADER_SIZE ||
+       total > AbstractPacket::HEADER_SIZE + 65535 || length == 0 ||
+       length > total)
+      return nullptr;
+    // Every piece but the last has the same length, so pieces locate
+    // themselves without carrying an offset
+    size_t offset = (index == count - 1) ? total - length : index * length;
+    if(offset + length > total)
+      return nullptr;
+    
+    // Drop partial packets that have timed out, and find this one's
+    Message* message = nullptr;
+    Message* spare = nullptr;
+    for(size_t i = 0; i < messages.size(); i++)
+    {
+      Message& candidate = messages[i];
+      if(candidate.active &&
+         std::chrono::duration<double>(now - candidate.started).count() >
+         timeout)
+        drop(candidate);
+      if(!candidate.active)
+      {
+        if(!spare)
+          spare = &candidate;
+      }
+      else if(candidate.slot == slot && candidate.id == piece.message())
+        message = &candidate;
+    }
+    
+    if(!message)
+    {
+      if(total > maxBytes)
+        return nullptr;
+      // Make room by dropping the oldest partial packets
+      while(pending + total > maxBytes)
+      {
+        Message* oldest = nullptr;
+        for(size_t i = 0; i < messages.size(); i++)
+        {
+          if(messages[i].active &&
+             (!oldest || messages[i].started < oldest->started))
+            oldest = &messages[i];
+        }
+        drop(*oldest);
+        if(!spare || oldest < spare)
+          spare = oldest;
+      }
+      if(!spare)
+      {
+        messages.push_back(Message());
+        spare = &messages.back();
+      }
+      message = spare;
+      message->active = true;
+      message->slot = slot;
+      message->id = piece.message();
+      message->count = count;
+      message->received = 0;
+      message->data.resize(total);
+      message->have.assign(count, false);
+      message->started = now;
+      pending += total;
+    }
+    else if(message->count != count || message->data.size() != total)
+      return nullptr;
+    if(message->have[index])
+      return nullptr;
+    
+    memcpy(message->data.data() + offset, piece.bytes(), length);
+    message->have[index] = true;
+    if(++message->received < count)
+      return nullptr;
+    
+    // Hand out the completed buffer, keeping the old one in the pool
+    drop(*message);
+    complete.swap(message->data);
+    if(!PacketView::isValid(complete.data(), complete.size()) ||
+       PacketView(complete.data()).getLength() != complete.size())
+      return nullptr;
+    return &complete;
+  }
+  void Reassembler::forget(size_t slot)
+  {
+    for(size_t i = 0; i < messages.size(); i++)
+    {
+      if(messages[i].active && messages[i].slot == slot)
+        drop(messages[i]);
+    }
+  }
+  size_t Reassembler::getPending() const
+  {
+    return pending;
+  }
+  void Reassembler::drop(Message& message)
+  {
+    message.active = false;
+    pending -= message.data.size();
+  }
+}
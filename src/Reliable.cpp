@@ -0,0 +1,298 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Reliable.cpp
+ * ----------------------------------------------------------------------------
+ */
+#include "Reliable.h"
+#include "Packet.h"
+namespace wic
+{
+  // Retransmission timeouts, in seconds.
+  static const double INITIAL_TIMEOUT = 0.25;
+  static const double MIN_TIMEOUT = 0.02;
+  static const double MAX_TIMEOUT = 2.0;
+  
+  ReliableEndpoint::Entry::Entry()
+  : flags(0), order(0), used(false), sent(false), resent(false),
+    interval(0.0)
+  {
+  }
+  ReliableEndpoint::ReliableEndpoint()
+  {
+    reset();
+  }
+  void ReliableEndpoint::reset()
+  {
+    nextSequence = 0;
+    oldest = 0;
+    for(size_t i = 0; i < 64; i++)
+      window[i] = Entry();
+    backlog.clear();
+    srtt = 0.0;
+    rttvar = 0.0;
+    sampled = false;
+    receivedAny = false;
+    ackOwed = false;
+    latest = 0;
+    latestBits = 0;
+    for(uint8_t i = 0; i < CHANNELS; i++)
+    {
+      nextOrder[i] = 0;
+      expected[i] = 0;
+      held[i].clear();
+    }
+  }
+  bool ReliableEndpoint::push(const uint8_t* packet, size_t length,
+                              uint8_t channel, bool ordered)
+  {
+    if(channel >= CHANNELS)
+      throw InvalidArgument("channel", ">= CHANNELS");
+    if(backlog.size() == MAX_BACKLOG)
+      return false;
+    backlog.push_back(Entry());
+    Entry& entry = backlog.back();
+    entry.packet.assign(packet, packet + length);
+    entry.flags = channel;
+    if(ordered)
+    {
+      entry.flags |= Reliable::ORDERED;
+      entry.order = nextOrder[channel]++;
+    }
+    fill();
+    return true;
+  }
+  void ReliableEndpoint::fill()
+  {
+    // Give waiting packets sequence numbers while the window has room
+    while(!backlog.empty() && (uint16_t) (nextSequence - oldest) < WINDOW)
+    {
+      Entry& entry = window[nextSequence % 64];
+      entry = std::move(backlog.front());
+      entry.used = true;
+      backlog.pop_front();
+      nextSequence++;
+    }
+  }
+  bool ReliableEndpoint::receive(const PacketView& envelope,
+                                 NetClock::time_point now,
+                                 vector<uint8_t>& out)
+  {
+    if(envelope.getSize() < Reliable::SIZE)
+      return false;
+    Reliable reliable(envelope);
+    if(reliable.hasAck())
+      acknowledge(reliable.ack(), reliable.ackBits(), now);
+    if(reliable.channel() >= CHANNELS ||
+       !PacketView::isValid(reliable.packet(), reliable.packetLength()))
+      return false;
+    
+    // Record the sequence number, dropping duplicates. Either way the peer
+    // is owed an acknowledgement.
+    uint16_t sequence = reliable.sequence();
+    ackOwed = true;
+    if(!receivedAny)
+    {
+      receivedAny = true;
+      latest = sequence;
+      latestBits = 0;
+    }
+    else
+    {
+      int16_t ahead = sequence - latest;
+      if(ahead > 0)
+      {
+        latestBits = (ahead < 32 ? latestBits << ahead : 0) |
+                     (ahead <= 32 ? (uint32_t) 1 << (ahead - 1) : 0);
+        latest = sequence;
+      }
+      else if(ahead == 0 || ahead < -32)
+        return false;
+      else
+      {
+        uint32_t bit = (uint32_t) 1 << (-ahead - 1);
+        if(latestBits & bit)
+          return false;
+        latestBits |= bit;
+      }
+    }
+    
+    // Deliver, holding ordered packets until those before them arrive
+    const uint8_t* packet = reliable.packet();
+    size_t length = PacketView(packet).getLength();
+    if(!reliable.ordered())
+    {
+      out.insert(out.end(), packet, packet + length);
+      return false;
+    }
+    uint8_t channel = reliable.channel();
+    int16_t early = reliable.order() - expected[channel];
+    if(early < 0 || early > (int16_t) WINDOW)
+      return true;
+    if(early > 0)
+    {
+      held[channel][reliable.order()].assign(packet, packet + length);
+      return true;
+    }
+    out.insert(out.end(), packet, packet + length);
+    expected[channel]++;
+    std::map<uint16_t, vector<uint8_t>>& waiting = held[channel];
+    std::map<uint16_t, vector<uint8_t>>::iterator next;
+    while((next = waiting.find(expected[channel])) != waiting.end())
+    {
+      out.insert(out.end(), next->second.begin(), next->second.end());
+      waiting.erase(next);
+      expected[channel]++;
+    }
+    return true;
+  }
+  void ReliableEndpoint::acknowledge(const PacketView& ack,
+                                     NetClock::time_point now)
+  {
+    if(ack.getSize() < Ack::SIZE)
+      return;
+    Ack packet(ack);
+    acknowledge(packet.ack(), packet.ackBits(), now);
+  }
+  void ReliableEndpoint::acknowledge(uint16_t ack, uint32_t ackBits,
+                                     NetClock::time_point now)
+  {
+    for(uint16_t i = 0; i < WINDOW; i++)
+    {
+      if(i > 0 && !(ackBits & ((uint32_t) 1 << (i - 1))))
+        continue;
+      uint16_t sequence = ack - i;
+      // Only sequence numbers in flight may be acknowledged
+      if((uint16_t) (sequence - oldest) >= (uint16_t) (nextSequence - oldest))
+        continue;
+      Entry& entry = window[sequence % 64];
+      if(!entry.used)
+        continue;
+      
+      // Measure the round trip, except for retransmissions (Karn)
+      if(entry.sent && !entry.resent)
+      {
+        double rtt = std::chrono::duration<double>(now -
+                                                   entry.firstSent).count();
+        if(!sampled)
+        {
+          srtt = rtt;
+          rttvar = rtt / 2;
+          sampled = true;
+        }
+        else
+        {
+          rttvar = 0.75 * rttvar + 0.25 * std::abs(srtt - rtt);
+          srtt = 0.875 * srtt + 0.125 * rtt;
+        }
+      }
+      entry = Entry();
+    }
+    while(oldest != nextSequence && !window[oldest % 64].used)
+      oldest++;
+    
+    // Envelopes older than the acknowledged one that have had a round trip
+    // to arrive were probably lost; send them again without waiting
+    NetClock::duration rtt = std::chrono::duration_cast<NetClock::duration>(
+                             std::chrono::duration<double>(srtt));
+    for(uint16_t sequence = oldest; (int16_t) (ack - sequence) > 0 &&
+        sequence != nextSequence; sequence++)
+    {
+      Entry& entry = window[sequence % 64];
+      if(entry.used && entry.sent && now - entry.lastSent >= rtt)
+        entry.nextSend = now;
+    }
+    fill();
+  }
+  size_t ReliableEndpoint::emit(NetClock::time_point now, uint16_t source,
+                                uint8_t* dest, size_t capacity)
+  {
+    size_t offset = 0;
+    uint8_t ackFlag = receivedAny ? Reliable::HAS_ACK : 0;
+    for(uint16_t sequence = oldest; sequence != nextSequence; sequence++)
+    {
+      Entry& entry = window[sequence % 64];
+      if(!entry.used || entry.nextSend > now)
+        continue;
+      size_t length = OVERHEAD + entry.packet.size();
+      if(length > capacity - offset)
+        break;
+      Reliable reliable(entry.flags | ackFlag, sequence, entry.order, latest,
+                        latestBits, entry.packet.data(), entry.packet.size());
+      offset += reliable.toBuffer(dest + offset, capacity - offset, source);
+      
+      // Back off exponentially on retransmission
+      if(entry.sent)
+      {
+        entry.resent = true;
+        entry.interval *= 2;
+        if(entry.interval > MAX_TIMEOUT)
+          entry.interval = MAX_TIMEOUT;
+      }
+      else
+      {
+        entry.sent = true;
+        entry.firstSent = now;
+        entry.interval = timeout();
+      }
+      entry.lastSent = now;
+      entry.nextSend = now + std::chrono::duration_cast<NetClock::duration>(
+                       std::chrono::duration<double>(entry.interval));
+      if(receivedAny)
+        ackOwed = false;
+    }
+    if(ackOwed && capacity - offset >= AbstractPacket::HEADER_SIZE + Ack::SIZE)
+    {
+      offset += Ack(latest, latestBits).toBuffer(dest + offset,
+                                                 capacity - offset, source);
+      ackOwed = false;
+    }
+    return offset;
+  }
+  bool ReliableEndpoint::isIdle() const
+  {
+    return oldest == nextSequence && backlog.empty() && !ackOwed;
+  }
+  size_t ReliableEndpoint::getLargest() const
+  {
+    size_t largest = 0;
+    for(uint16_t sequence = oldest; sequence != nextSequence; sequence++)
+    {
+      const Entry& entry = window[sequence % 64];
+      if(entry.used)
+        largest = std::max(largest, entry.packet.size());
+    }
+    for(size_t i = 0; i < backlog.size(); i++)
+      largest = std::max(largest, backlog[i].packet.size());
+    return largest;
+  }
+  double ReliableEndpoint::getRTT() const
+  {
+    return srtt;
+  }
+  double ReliableEndpoint::timeout() const
+  {
+    if(!sampled)
+      return INITIAL_TIMEOUT;
+    double result = srtt + 4 * rttvar;
+    if(result < MIN_TIMEOUT)
+      return MIN_TIMEOUT;
+    if(result > MAX_TIMEOUT)
+      return MAX_TIMEOUT;
+    return result;
+  }
+}
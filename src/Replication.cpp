@@ -0,0 +1,298 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Replication.cpp
+ * ----------------------------------------------------------------------------
+ */
+#include "Replication.h"
+namespace wic
+{
+  // Varint helpers (seven bits per byte, least significant first).
+  static bool putVarint(uint8_t* dest, size_t capacity, size_t& offset,
+                        size_t value)
+  {
+    do
+    {
+      if(offset == capacity)
+        return false;
+      uint8_t byte = value & 0x7F;
+      value >>= 7;
+      dest[offset++] = value ? (byte | 0x80) : byte;
+    } while(value);
+    return true;
+  }
+  static bool getVarint(const uint8_t* src, size_t length, size_t& offset,
+                        size_t& value)
+  {
+    value = 0;
+    for(unsigned shift = 0; shift < 64; shift += 7)
+    {
+      if(offset == length)
+        return false;
+      uint8_t byte = src[offset++];
+      value |= (size_t) (byte & 0x7F) << shift;
+      if(!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+  
+  size_t DeltaCodec::encode(const uint8_t* state, size_t length,
+                            const uint8_t* base, size_t baseLength,
+                            uint8_t* dest, size_t capacity)
+  {
+    size_t offset = 0;
+    if(!putVarint(dest, capacity, offset, length))
+      return 0;
+    size_t i = 0;
+    while(i < length)
+    {
+      // Skip unchanged bytes
+      size_t start = i;
+      while(i < length && state[i] == (i < baseLength ? base[i] : 0))
+        i++;
+      if(i == length)
+        break;
+      size_t skip = i - start;
+      
+      // Take changed bytes, absorbing single unchanged bytes (which are
+      // cheaper to send than to skip)
+      start = i;
+      while(i < length &&
+            (state[i] != (i < baseLength ? base[i] : 0) ||
+             (i + 1 < length &&
+              state[i + 1] != (i + 1 < baseLength ? base[i + 1] : 0))))
+        i++;
+      size_t count = i - start;
+      if(!putVarint(dest, capacity, offset, skip) ||
+         !putVarint(dest, capacity, offset, count) ||
+         capacity - offset < count)
+        return 0;
+      for(size_t j = start; j < i; j++)
+        dest[offset++] = state[j] ^ (j < baseLength ? base[j] : 0);
+    }
+    return offset;
+  }
+  bool DeltaCodec::decode(const uint8_t* delta, size_t deltaLength,
+                          const uint8_t* base, size_t baseLength,
+                          vector<uint8_t>& dest)
+  {
+    size_t offset = 0;
+    size_t length;
+    if(!getVarint(delta, deltaLength, offset, length) || length > MAX_LENGTH)
+      return false;
+    dest.assign(length, 0);
+    if(baseLength > 0)
+      memcpy(dest.data(), base, baseLength < length ? baseLength : length);
+    size_t position = 0;
+    while(offset < deltaLength)
+    {
+      size_t skip, count;
+      if(!getVarint(delta, deltaLength, offset, skip) ||
+         !getVarint(delta, deltaLength, offset, count))
+        return false;
+      if(skip > length - position || count > length - position - skip ||
+         count > deltaLength - offset)
+        return false;
+      position += skip;
+      for(size_t i = 0; i < count; i++)
+        dest[position++] ^= delta[offset++];
+    }
+    return true;
+  }
+  
+  SnapshotSender::SnapshotSender(Server& server, unsigned history)
+  : server(server), tick(0), acked(server.getMaxNodes(), 0),
+    generations(server.getMaxNodes(), 0), baseSlots(server.getMaxNodes())
+  {
+    if(history == 0)
+      throw InvalidArgument("history", "zero");
+    this->history.resize(history);
+    historyTicks.resize(history, 0);
+    deltas.resize(history + 1);
+    deltaTicks.resize(history + 1, 0);
+  }
+  SnapshotSender::SnapshotSender(Server& server)
+  : SnapshotSender(server, 32)
+  {
+  }
+  void SnapshotSender::send(const uint8_t* state, size_t length)
+  {
+    uint32_t next = tick + 1;
+    size_t none = history.size();
+    size_t capacity = 65535 - Snapshot::SIZE;
+    
+    // Encode once per distinct baseline before queueing anything, so that
+    // an oversized snapshot leaves every client untouched
+    for(NodeID i = 1; i <= server.getMaxID(); i++)
+    {
+      if(!server.isUsed(i))
+      {
+        acked[i] = 0;
+        continue;
+      }
+      track(i);
+      size_t slot = none;
+      if(acked[i] != 0 && historyTicks[acked[i] % none] == acked[i])
+        slot = acked[i] % none;
+      baseSlots[i] = slot;
+      if(deltaTicks[slot] == next)
+        continue;
+      
+      vector<uint8_t>& delta = deltas[slot];
+      delta.resize(capacity);
+      size_t deltaLength;
+      if(slot == none)
+        deltaLength = DeltaCodec::encode(state, length, nullptr, 0,
+                                         delta.data(), capacity);
+      else
+        deltaLength = DeltaCodec::encode(state, length, history[slot].data(),
+                                         history[slot].size(), delta.data(),
+                                         capacity);
+      if(deltaLength == 0)
+      {
+        std::fill(deltaTicks.begin(), deltaTicks.end(), 0);
+        throw InvalidArgument("delta", "> 65527 bytes");
+      }
+      delta.resize(deltaLength);
+      deltaTicks[slot] = next;
+    }
+    
+    // Keep the snapshot as a future baseline, then queue the deltas
+    tick = next;
+    history[tick % none].assign(state, state + length);
+    historyTicks[tick % none] = tick;
+    for(NodeID i = 1; i <= server.getMaxID(); i++)
+    {
+      if(!server.isUsed(i))
+        continue;
+      size_t slot = baseSlots[i];
+      uint32_t baseTick = (slot == none) ? 0 : acked[i];
+      server.queue(Snapshot(tick, baseTick, deltas[slot].data(),
+                            deltas[slot].size()), i);
+    }
+  }
+  void SnapshotSender::send(const vector<uint8_t>& state)
+  {
+    send(state.data(), state.size());
+  }
+  bool SnapshotSender::handle(const PacketView& packet)
+  {
+    if(!packet.isType<SnapshotAck>())
+      return false;
+    if(packet.getSize() >= SnapshotAck::SIZE)
+      acknowledge(packet.getSource(), SnapshotAck(packet).tick());
+    return true;
+  }
+  bool SnapshotSender::handle(const AbstractPacket& packet)
+  {
+    if(packet.getType() != SnapshotAck::TYPE)
+      return false;
+    if(packet.getSize() >= SnapshotAck::SIZE)
+      acknowledge(packet.getSource(), SnapshotAck(packet).tick());
+    return true;
+  }
+  uint32_t SnapshotSender::getTick() const
+  {
+    return tick;
+  }
+  void SnapshotSender::acknowledge(NodeID sourceID, uint32_t ackTick)
+  {
+    // Acknowledgements may arrive out of order; keep the newest
+    if(sourceID == 0 || sourceID >= acked.size())
+      return;
+    track(sourceID);
+    if(ackTick > acked[sourceID] && ackTick <= tick)
+      acked[sourceID] = ackTick;
+  }
+  void SnapshotSender::track(NodeID ID)
+  {
+    uint32_t generation = server.getGeneration(ID);
+    if(generations[ID] != generation)
+    {
+      generations[ID] = generation;
+      acked[ID] = 0;
+    }
+  }
+  
+  SnapshotReceiver::SnapshotReceiver(Client& client, unsigned history)
+  : client(client), tick(0)
+  {
+    if(history == 0)
+      throw InvalidArgument("history", "zero");
+    this->history.resize(history);
+    historyTicks.resize(history, 0);
+  }
+  SnapshotReceiver::SnapshotReceiver(Client& client)
+  : SnapshotReceiver(client, 32)
+  {
+  }
+  bool SnapshotReceiver::handle(const PacketView& packet)
+  {
+    if(!packet.isType<Snapshot>())
+      return false;
+    if(packet.getSize() >= Snapshot::SIZE)
+      apply(Snapshot(packet));
+    return true;
+  }
+  bool SnapshotReceiver::handle(const AbstractPacket& packet)
+  {
+    if(packet.getType() != Snapshot::TYPE)
+      return false;
+    if(packet.getSize() >= Snapshot::SIZE)
+      apply(Snapshot(packet));
+    return true;
+  }
+  const vector<uint8_t>& SnapshotReceiver::getSnapshot() const
+  {
+    return history[tick % history.size()];
+  }
+  uint32_t SnapshotReceiver::getTick() const
+  {
+    return tick;
+  }
+  void SnapshotReceiver::apply(const Snapshot& snapshot)
+  {
+    // Ignore stale and duplicate snapshots
+    uint32_t newTick = snapshot.tick();
+    uint32_t baseTick = snapshot.baseTick();
+    if(newTick <= tick || baseTick >= newTick)
+      return;
+    
+    // The baseline must still be kept
+    const uint8_t* base = nullptr;
+    size_t baseLength = 0;
+    if(baseTick != 0)
+    {
+      size_t slot = baseTick % history.size();
+      if(historyTicks[slot] != baseTick)
+        return;
+      base = history[slot].data();
+      baseLength = history[slot].size();
+    }
+    
+    // Decode aside, since the new snapshot may replace its own baseline
+    if(!DeltaCodec::decode(snapshot.delta(), snapshot.deltaLength(), base,
+                           baseLength, scratch))
+      return;
+    size_t slot = newTick % history.size();
+    history[slot].swap(scratch);
+    historyTicks[slot] = newTick;
+    tick = newTick;
+    client.queue(SnapshotAck(tick));
+  }
+}
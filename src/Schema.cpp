@@ -0,0 +1,43 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Schema.cpp
+ * ----------------------------------------------------------------------------
+ */
+#include "Schema.h"
+namespace wic
+{
+  TextView::TextView(const char* data, size_t capacity)
+  : data_(data)
+  {
+    const void* end = memchr(data, '\0', capacity);
+    length_ = end ? (const char*) end - data : capacity;
+  }
+  const char* TextView::data() const  { return data_; }
+  size_t TextView::length() const     { return length_; }
+  string TextView::str() const        { return string(data_, length_); }
+  TextView::operator string() const   { return str(); }
+  bool TextView::operator==(const string& other) const
+  {
+    return other.size() == length_ &&
+           memcmp(other.data(), data_, length_) == 0;
+  }
+  bool TextView::operator!=(const string& other) const
+  {
+    return !(*this == other);
+  }
+}
@@ -21,17 +21,31 @@
 #include "Server.h"
 namespace wic
 {
-  // Utility buffer.
-  const size_t bufferSize = 255;
-  uint8_t buffer[bufferSize];
+  const size_t SCRATCH_SIZE = 16384;
+  typedef std::lock_guard<std::recursive_mutex> RosterLock;
 
-  Server::Server(string name, unsigned port, uint8_t maxClients)
-  : Node(name, port)
+  Server::Server(string name, unsigned port, NodeID maxClients)
+  : Server(name, port, maxClients, 1)
+  {
+  }
+  Server::Server(string name, unsigned port, NodeID maxClients,
+                 unsigned shardCount)
+  : Node(name, checkPort(port), shardCount > 1), nextShard(0),
+    interest(256.0), bandwidth(0), timeouts(256, 0.1),
+    timeout(NetClock::duration::zero()), started(NetClock::now()),
+    sharding(false)
   {
     if(maxClients == 0)
       throw InvalidArgument("maxClients", "zero");
-    if(maxClients > 254)
-      throw InvalidArgument("maxClients", "> 254");
+    if(maxClients > 65534)
+      throw InvalidArgument("maxClients", "> 65534");
+    if(shardCount == 0)
+      throw InvalidArgument("shardCount", "zero");
+    
+    // Control packets from verified clients
+    control.setHandler<Heartbeat, Server, &Server::onHeartbeat>(this);
+    control.setHandler<TimeRequest, Server, &Server::onTimeRequest>(this);
+    control.setHandler<Leaving, Server, &Server::onLeaving>(this);
     
     joined = true;
     ID = 0;
@@ -39,35 +53,212 @@ namespace wic
     addrs.resize(getMaxNodes());
     addrs[0] = addr;
     used.resize(getMaxNodes());
-    used[0] = true;
     names.resize(getMaxNodes());
-    names[0] = name;
     ips.resize(getMaxNodes());
+    shardOf.resize(getMaxNodes());
+    lastSeen.resize(getMaxNodes());
+    generations.resize(getMaxNodes(), 0);
+    freeIDs.resize((getMaxNodes() + 63) / 64);
+    for(NodeID i = 1; i <= maxID; i++)
+      freeIDs[i / 64] |= (uint64_t) 1 << (i % 64);
+    clientCount = 0;
     char tmp[20];
     inet_ntop(AF_INET, &addr.sin_addr, tmp, INET_ADDRSTRLEN);
-    ips[0] = string(tmp);
+    connect(0, addr, name, string(tmp), 0);
+    
+    // Open the remaining sockets on the same port and start a worker for each
+    if(shardCount > 1)
+    {
+      shards.push_back(new Shard(sock, recvRing.getSlotSize()));
+      try
+      {
+        for(unsigned i = 1; i < shardCount; i++)
+          shards.push_back(new Shard(openSocket(port, true),
+                                     recvRing.getSlotSize()));
+      }
+      catch(...)
+      {
+        for(unsigned i = 1; i < shards.size(); i++)
+          close(shards[i]->sock);
+        for(unsigned i = 0; i < shards.size(); i++)
+          delete shards[i];
+        close(sock);
+        throw;
+      }
+      sharding = true;
+      for(unsigned i = 0; i < shards.size(); i++)
+        shards[i]->worker = std::thread(&Server::work, this, i);
+    }
   }
   Server::~Server()
   {
+    update();
     sendAll(Shutdown());
+    sharding = false;
+    for(unsigned i = 0; i < shards.size(); i++)
+    {
+      shards[i]->worker.join();
+      if(i > 0)
+        close(shards[i]->sock);
+      delete shards[i];
+    }
+    stopIOThread();
     close(sock);
   }
+  Server::Shard::Shard(int sock, size_t slotSize)
+  : sock(sock), ring(RING_SIZE, slotSize), held(0)
+  {
+  }
+  unsigned Server::getShardCount() const
+  {
+    return shards.empty() ? 1 : shards.size();
+  }
+  void Server::startIOThread()
+  {
+    if(!shards.empty())
+      throw Error("sharded servers drain their sockets on worker threads");
+    Node::startIOThread();
+  }
+  thread_local vector<struct sockaddr_in> Server::recipients;
   void Server::send(const AbstractPacket& packet, NodeID destID) const
   {
+    // The roster lock is only held while the destination is looked up, so
+    // that several threads may serialize and send at once
+    struct sockaddr_in destAddr = lookup(destID);
+
+    // Server doesn't mess with the source
+    sendPieces(fragment(packet, packet.getSource(), getMTU()), destAddr);
+  }
+  void Server::sendExclude(const AbstractPacket &packet, NodeID excludeID) const
+  {
+    {
+      RosterLock lock(rosterMutex);
+      if(excludeID  == 0)
+        throw InvalidArgument("excludeID", "zero");
+      if(excludeID > getMaxID())
+        throw InvalidArgument("excludeID", "maxID");
+      if(!isUsed(excludeID))
+        throw InvalidArgument("destID", "unused");
+    }
+    broadcast(packet, excludeID);
+  }
+  void Server::sendAll(const AbstractPacket& packet) const
+  {
+    broadcast(packet, 0);
+  }
+  struct sockaddr_in Server::lookup(NodeID destID) const
+  {
+    RosterLock lock(rosterMutex);
     if(destID == 0)
       throw InvalidArgument("destID", "zero");
     if(destID > getMaxID())
       throw InvalidArgument("destID", "> maxID");
     if(!isUsed(destID))
       throw InvalidArgument("destID", "unused");
-
-    size_t size = AbstractPacket::HEADER_SIZE + packet.getSize();
-    packet.toBuffer(buffer, packet.getSource());
+    return addrs[destID];
+  }
+  void Server::broadcast(const AbstractPacket& packet, NodeID excludeID) const
+  {
+    // Copy the recipients' addresses under the roster lock, then send
+    // without it
+    recipients.clear();
+    {
+      RosterLock lock(rosterMutex);
+      for(NodeID i = 1; i <= maxID; i++)
+      {
+        if(i != excludeID && used[i])
+          recipients.push_back(addrs[i]);
+      }
+    }
+    sendRecipients(packet);
+  }
+  void Server::sendRecipients(const AbstractPacket& packet) const
+  {
+    if(recipients.empty())
+      return;
+    
+    // Serialize (and fragment) once; every client's datagrams point at the
+    // same bytes
+    size_t pieceCount = fragment(packet, packet.getSource(), getMTU());
+    
+    Datagram datagrams[BATCH_SIZE];
+    size_t count = 0;
+    for(size_t i = 0; i < recipients.size(); i++)
+    {
+      size_t offset = 0;
+      for(size_t j = 0; j < pieceCount; j++)
+      {
+        datagrams[count].data = pieces.data() + offset;
+        datagrams[count].length = PacketView(pieces.data() + offset)
+                                  .getLength();
+        datagrams[count].addr = recipients[i];
+        offset += datagrams[count].length;
+        if(++count == BATCH_SIZE)
+        {
+          sendDatagrams(datagrams, count);
+          count = 0;
+        }
+      }
+    }
+    if(count > 0)
+      sendDatagrams(datagrams, count);
+  }
+  void Server::sendBatch(const vector<const AbstractPacket*>& packets,
+                         NodeID destID) const
+  {
+    struct sockaddr_in destAddr = lookup(destID);
+    
+    // Pack the serialized packets into one scratch area, flushing whenever
+    // it or the batch fills. Packets too large for one datagram are
+    // fragmented and sent on their own.
+    uint8_t scratch[SCRATCH_SIZE];
+    Datagram datagrams[BATCH_SIZE];
+    size_t count = 0;
+    size_t filled = 0;
+    for(size_t i = 0; i < packets.size(); i++)
+    {
+      const AbstractPacket& packet = *packets[i];
+      size_t length = AbstractPacket::HEADER_SIZE + packet.getSize();
+      if(length > getMTU())
+      {
+        sendPieces(fragment(packet, packet.getSource(), getMTU()),
+                   destAddr);
+        continue;
+      }
+      if(count == BATCH_SIZE || filled + length > SCRATCH_SIZE)
+      {
+        sendDatagrams(datagrams, count);
+        count = 0;
+        filled = 0;
+      }
+      datagrams[count].data = scratch + filled;
+      // Server doesn't mess with the source
+      datagrams[count].length = packet.toBuffer(scratch + filled, Node::MTU,
+                                                packet.getSource());
+      datagrams[count].addr = destAddr;
+      filled += length;
+      count++;
+    }
+    if(count > 0)
+      sendDatagrams(datagrams, count);
+  }
+  void Server::queue(const AbstractPacket& packet, NodeID destID)
+  {
+    RosterLock lock(rosterMutex);
+    if(destID == 0)
+      throw InvalidArgument("destID", "zero");
+    if(destID > getMaxID())
+      throw InvalidArgument("destID", "> maxID");
+    if(!isUsed(destID))
+      throw InvalidArgument("destID", "unused");
+    
     // Server doesn't mess with the source
-    sendto(sock, buffer, size, 0, (struct sockaddr*) &addrs[destID], lenAddr);
+    queuePieces(fragment(packet, packet.getSource(), getMTU()), destID,
+                addrs[destID]);
   }
-  void Server::sendExclude(const AbstractPacket &packet, NodeID excludeID) const
+  void Server::queueExclude(const AbstractPacket& packet, NodeID excludeID)
   {
+    RosterLock lock(rosterMutex);
     if(excludeID  == 0)
       throw InvalidArgument("excludeID", "zero");
     if(excludeID > getMaxID())
@@ -75,126 +266,525 @@ namespace wic
     if(!isUsed(excludeID))
       throw InvalidArgument("destID", "unused");
     
+    queueBroadcast(packet, excludeID);
+  }
+  void Server::queueAll(const AbstractPacket& packet)
+  {
+    RosterLock lock(rosterMutex);
+    queueBroadcast(packet, 0);
+  }
+  void Server::queueBroadcast(const AbstractPacket& packet, NodeID excludeID)
+  {
+    size_t count = fragment(packet, packet.getSource(), getMTU());
     for(NodeID i = 1; i <= maxID; i++)
     {
       if(i != excludeID && used[i])
-        send(packet, i);
+        queuePieces(count, i, addrs[i]);
     }
   }
-  void Server::sendAll(const AbstractPacket& packet) const
+  void Server::sendReliable(const AbstractPacket& packet, NodeID destID,
+                            uint8_t channel)
+  {
+    RosterLock lock(rosterMutex);
+    if(destID == 0)
+      throw InvalidArgument("destID", "zero");
+    if(destID > getMaxID())
+      throw InvalidArgument("destID", "> maxID");
+    if(!isUsed(destID))
+      throw InvalidArgument("destID", "unused");
+    
+    enqueueReliable(packet, packet.getSource(), channel, destID,
+                    addrs[destID]);
+  }
+  void Server::sendReliableAll(const AbstractPacket& packet, uint8_t channel)
+  {
+    RosterLock lock(rosterMutex);
+    reliableBroadcast(packet, 0, channel, false);
+  }
+  void Server::reliableBroadcast(const AbstractPacket& packet,
+                                 NodeID excludeID, uint8_t channel,
+                                 bool immediately)
   {
+    for(NodeID i = 1; i <= maxID; i++)
+    {
+      if(i == excludeID || !used[i])
+        continue;
+      enqueueReliable(packet, packet.getSource(), channel, i, addrs[i]);
+      if(immediately)
+        transmitReliable(i);
+    }
+  }
+  void Server::setBandwidth(NodeID ID, size_t bytesPerSecond)
+  {
+    RosterLock lock(rosterMutex);
+    if(ID == 0)
+      throw InvalidArgument("ID", "zero");
+    if(ID > getMaxID())
+      throw InvalidArgument("ID", "> maxID");
+    if(!isUsed(ID))
+      throw InvalidArgument("ID", "unused");
+    setBudget(ID, bytesPerSecond);
+  }
+  void Server::setBandwidthAll(size_t bytesPerSecond)
+  {
+    RosterLock lock(rosterMutex);
+    bandwidth = bytesPerSecond;
     for(NodeID i = 1; i <= maxID; i++)
     {
       if(used[i])
-        send(packet, i);
+        setBudget(i, bytesPerSecond);
+    }
+  }
+  void Server::setView(NodeID ID, const Bounds& view)
+  {
+    RosterLock lock(rosterMutex);
+    if(ID == 0)
+      throw InvalidArgument("ID", "zero");
+    if(ID > getMaxID())
+      throw InvalidArgument("ID", "> maxID");
+    if(!isUsed(ID))
+      throw InvalidArgument("ID", "unused");
+    interest.setView(ID, view);
+  }
+  void Server::clearView(NodeID ID)
+  {
+    RosterLock lock(rosterMutex);
+    interest.removeView(ID);
+  }
+  void Server::setCellSize(double cellSize)
+  {
+    RosterLock lock(rosterMutex);
+    interest.setCellSize(cellSize);
+  }
+  void Server::sendNear(const AbstractPacket& packet, const Pair& position)
+  {
+    sendNearby(packet, position, 0);
+  }
+  void Server::sendNearExclude(const AbstractPacket& packet,
+                               const Pair& position, NodeID excludeID)
+  {
+    sendNearby(packet, position, excludeID);
+  }
+  void Server::queueNear(const AbstractPacket& packet, const Pair& position)
+  {
+    RosterLock lock(rosterMutex);
+    queueNearby(packet, position, 0);
+  }
+  void Server::queueNearExclude(const AbstractPacket& packet,
+                                const Pair& position, NodeID excludeID)
+  {
+    RosterLock lock(rosterMutex);
+    queueNearby(packet, position, excludeID);
+  }
+  void Server::sendNearby(const AbstractPacket& packet, const Pair& position,
+                          NodeID excludeID)
+  {
+    // As in broadcast, the lock is only held while the recipients are found
+    recipients.clear();
+    {
+      RosterLock lock(rosterMutex);
+      interest.query(position, nearby);
+      for(size_t i = 0; i < nearby.size(); i++)
+      {
+        if(nearby[i] != excludeID)
+          recipients.push_back(addrs[nearby[i]]);
+      }
+    }
+    sendRecipients(packet);
+  }
+  void Server::queueNearby(const AbstractPacket& packet, const Pair& position,
+                           NodeID excludeID)
+  {
+    interest.query(position, nearby);
+    if(nearby.empty())
+      return;
+    size_t count = fragment(packet, packet.getSource(), getMTU());
+    for(size_t i = 0; i < nearby.size(); i++)
+    {
+      if(nearby[i] != excludeID)
+        queuePieces(count, nearby[i], addrs[nearby[i]]);
     }
   }
+  void Server::update()
+  {
+    RosterLock lock(rosterMutex);
+    expire(NetClock::now());
+    flushAll();
+  }
+  void Server::setTimeout(double seconds)
+  {
+    if(!(seconds >= 0.0))
+      throw InvalidArgument("seconds", "< 0");
+    RosterLock lock(rosterMutex);
+    timeout = std::chrono::duration_cast<NetClock::duration>(
+      std::chrono::duration<double>(seconds));
+    for(NodeID i = 1; i <= maxID; i++)
+    {
+      if(!used[i])
+        continue;
+      if(timeout > NetClock::duration::zero())
+        timeouts.schedule(i, lastSeen[i] + timeout);
+      else
+        timeouts.cancel(i);
+    }
+  }
+  double Server::getTimeout() const
+  {
+    return std::chrono::duration<double>(timeout).count();
+  }
+  double Server::getTime() const
+  {
+    return std::chrono::duration<double>(NetClock::now() - started).count();
+  }
+  uint32_t Server::getGeneration(NodeID ID) const
+  {
+    RosterLock lock(rosterMutex);
+    if(ID > getMaxID())
+      throw InvalidArgument("ID", "> maxID");
+    return generations[ID];
+  }
   bool Server::recv(MysteryPacket& result)
   {
-    struct sockaddr_in recvAddr;
-    socklen_t tmpLen = sizeof(recvAddr);
-    ssize_t length = recvfrom(sock, buffer, bufferSize, 0,
-                              (struct sockaddr*) &recvAddr, &tmpLen);
-    if(length > 0 && tmpLen == lenAddr)
+    bool unknown = false;
+    if(recvPacket(result, unknown))
+      return true;
+    if(unknown)
+      throw Failure("packet recieved from unknown source");
+    return false;
+  }
+  size_t Server::recvBatch(vector<MysteryPacket>& results, size_t max)
+  {
+    size_t count = recvViews(views, max);
+    if(results.size() < count)
+      results.resize(count);
+    for(size_t i = 0; i < count; i++)
+      results[i].populate(views[i]);
+    results.resize(count);
+    return count;
+  }
+  size_t Server::recvBatch(vector<PacketView>& results, size_t max)
+  {
+    return recvViews(results, max);
+  }
+  size_t Server::recvBatch(vector<PacketView>& results, size_t max,
+                           unsigned shard)
+  {
+    if(shard >= getShardCount())
+      throw InvalidArgument("shard", ">= shard count");
+    if(shards.empty())
+      return recvBatch(results, max);
+    
+    Shard& target = *shards[shard];
+    target.ring.pop(target.held);
+    target.held = 0;
+    size_t count = collectShard(target, results, 0, max);
+    
+    // Packets released rather than left in their datagrams belong to no
+    // shard in particular, so shard 0 takes them all
+    if(shard == 0)
+      count = unpackReleased(results, count);
+    results.resize(count);
+    return count;
+  }
+  Datagram* Server::nextDatagram(bool& unknown)
+  {
+    if(shards.empty())
+      return Node::nextDatagram(unknown);
+    
+    // Take the next datagram from the shards in turn. Workers have already
+    // dropped datagrams from unknown sources.
+    releaseShards();
+    for(unsigned n = 0; n < shards.size(); n++)
+    {
+      Shard& shard = *shards[nextShard];
+      nextShard = (nextShard + 1) % shards.size();
+      while(shard.ring.size() > 0)
+      {
+        Datagram& datagram = shard.ring.front(0);
+        if(datagram.length > 0)
+        {
+          shard.held = 1;
+          return &datagram;
+        }
+        shard.ring.pop(1);
+      }
+    }
+    return nullptr;
+  }
+  size_t Server::gather(vector<PacketView>& results, size_t max)
+  {
+    if(shards.empty())
+      return Node::gather(results, max);
+    
+    releaseShards();
+    size_t count = 0;
+    for(unsigned i = 0; i < shards.size() && max > 0; i++)
+    {
+      count = collectShard(*shards[i], results, count, max);
+      max -= shards[i]->held;
+    }
+    return count;
+  }
+  void Server::releaseShards()
+  {
+    for(unsigned i = 0; i < shards.size(); i++)
+    {
+      shards[i]->ring.pop(shards[i]->held);
+      shards[i]->held = 0;
+    }
+  }
+  size_t Server::takeShard(Shard& shard, size_t max)
+  {
+    shard.held = shard.ring.size();
+    if(shard.held > max)
+      shard.held = max;
+    return shard.held;
+  }
+  size_t Server::collectShard(Shard& shard, vector<PacketView>& results,
+                              size_t count, size_t max)
+  {
+    size_t taken = takeShard(shard, max);
+    for(size_t i = 0; i < taken; i++)
+      count = unpack(shard.ring.front(i), 0, results, count);
+    return count;
+  }
+  void Server::work(unsigned index)
+  {
+    Shard& shard = *shards[index];
+    Datagram* slots[BATCH_SIZE];
+    while(sharding)
+    {
+      size_t space = shard.ring.space();
+      if(space == 0)
+      {
+        // The consumer is behind; give it a moment
+        poll(nullptr, 0, 1);
+        continue;
+      }
+      if(space > BATCH_SIZE)
+        space = BATCH_SIZE;
+      for(size_t i = 0; i < space; i++)
+        slots[i] = &shard.ring.back(i);
+      size_t received = recvDatagrams(shard.sock, slots,
+                                      shard.ring.getSlotSize(), space);
+      if(received == 0)
+      {
+        struct pollfd fd;
+        fd.fd = shard.sock;
+        fd.events = POLLIN;
+        fd.revents = 0;
+        poll(&fd, 1, 10);
+        continue;
+      }
+      
+      // Verify and process the whole batch under a single lock. Rejected
+      // packets are removed, leaving empty datagrams to be skipped by
+      // consumers.
+      {
+        RosterLock lock(rosterMutex);
+        for(size_t i = 0; i < received; i++)
+          process(*slots[i], index);
+      }
+      shard.ring.push(received);
+    }
+  }
+  bool Server::process(Datagram& datagram, unsigned shard)
+  {
+    RosterLock lock(rosterMutex);
+    NetClock::time_point now = NetClock::now();
+    arrival = datagram.time;
+    
+    // Walk the coalesced packets, copying those to be delivered into a
+    // scratch area that then replaces the datagram's contents
+    uint8_t accepted[Node::MTU];
+    size_t length = 0;
+    bool unknown = false;
+    const struct sockaddr_in& recvAddr = datagram.addr;
+    for(size_t offset = 0;
+        PacketView::isValid(datagram.data + offset, datagram.length - offset);
+        offset += PacketView(datagram.data + offset).getLength())
     {
-      result.populate(buffer);
+      PacketView result(datagram.data + offset);
       
-      // Recieved packet is a join request, so process and return
+      // Recieved packet is a join request, so process and move on
       if(result.isType<JoinRequest>())
       {
+        if(result.getSize() < JoinRequest::SIZE)
+          continue;
         JoinRequest joinRequest(result);
+        string joinName = joinRequest.name();
         char ip[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &recvAddr.sin_addr, &ip[0], INET_ADDRSTRLEN);
         
-        // Search the blacklist. If banned, respond and return.
-        for(unsigned i = 0; i < blacklist.size(); i++)
+        // Clients resend join requests until answered, so a request from a
+        // connected address is usually a duplicate; answer it again. A new
+        // name means the old client is gone and a new one took its port.
+        auto existing = addrIndex.find(addrKey(recvAddr));
+        if(existing != addrIndex.end())
         {
-          if(blacklist[i] == string(ip) || blacklist[i] == joinRequest.name())
+          NodeID oldID = existing->second;
+          if(names[oldID] == joinName)
           {
-            JoinResponse joinResponse(JoinResponse::BANNED, maxID, 0, name);
-            size_t size = AbstractPacket::HEADER_SIZE + joinResponse.getSize();
-            joinResponse.toBuffer(buffer, Node::getID());
-            sendto(sock, buffer, size, 0, (struct sockaddr*) &recvAddr,
-                   lenAddr);
-            return true;
+            JoinResponse joinResponse(JoinResponse::OK, getMaxID(), oldID,
+                                      getName());
+            send(joinResponse, oldID);
+            continue;
           }
+          leave(oldID);
         }
         
-        // Determine connections. If full, respond and return
-        uint8_t nodes = 0;
-        for(NodeID i = 0; i <= maxID; i++)
+        // Check the blacklist and capacity. If refused, respond and pass the
+        // request on to the caller.
+        uint8_t code = JoinResponse::OK;
+        if(blacklist.count(ip) > 0 || blacklist.count(joinName) > 0)
+          code = JoinResponse::BANNED;
+        else if(clientCount == maxID)
+          code = JoinResponse::FULL;
+        if(code != JoinResponse::OK)
         {
-          if(isUsed(i))
-            nodes++;
-        }
-        if(nodes == getMaxNodes())
-        {
-          JoinResponse joinResponse(JoinResponse::FULL, maxID, 0, name);
-          size_t size = AbstractPacket::HEADER_SIZE + joinResponse.getSize();
-          joinResponse.toBuffer(buffer, getID());
-          sendto(sock, buffer, size, 0, (struct sockaddr*) &recvAddr, lenAddr);
-          return true;
+          uint8_t response[Node::MTU];
+          size_t size = JoinResponse::encode(response, getID(), code, maxID,
+                                             0, name);
+          sendDatagram(response, size, recvAddr);
+          memcpy(accepted + length, datagram.data + offset,
+                 result.getLength());
+          length += result.getLength();
+          continue;
         }
         
-        // Join ok. Find a new ID, set up new connection, and respond.
-        NodeID newID;
-        for(NodeID i = 1; i <= maxID; i++)
+        // Join ok. Take the lowest free ID, set up new connection, and
+        // respond.
+        NodeID newID = 0;
+        for(size_t i = 0; i < freeIDs.size(); i++)
         {
-          if(!used[i])
+          if(freeIDs[i] != 0)
           {
-            newID = i;
+            newID = i * 64 + __builtin_ctzll(freeIDs[i]);
             break;
           }
         }
-        
-        // Set up new connection
-        addrs[newID] = recvAddr;
-        used[newID] = true;
-        names[newID] = joinRequest.name();
-        char tmp[20];
-        inet_ntop(AF_INET, &recvAddr.sin_addr, tmp,INET_ADDRSTRLEN);
-        ips[newID] = string(tmp);
+        connect(newID, recvAddr, joinName, ip, shard);
         
         JoinResponse joinResponse(JoinResponse::OK, getMaxID(), newID,
                                   getName());
         send(joinResponse, newID);
         
-        // Bring all clients up to speed.
-        ClientJoined clientJoined(newID, joinRequest.name());
-        sendExclude(clientJoined, newID);
-        result.populate(clientJoined);
+        // Bring all clients up to speed over the roster channel. The others
+        // hear of the newcomer at the next update, coalesced with whatever
+        // else they are owed, so a burst of joins costs each of them one
+        // datagram rather than one per join. The newcomer gets a Roster of
+        // everyone at once (split only if it would overflow a packet). The
+        // caller sees a ClientJoined in place of the request, space
+        // permitting.
+        ClientJoined clientJoined(newID, joinName);
+        reliableBroadcast(clientJoined, newID, 0, false);
+        if(length + AbstractPacket::HEADER_SIZE + ClientJoined::SIZE <=
+           Node::MTU)
+          length += ClientJoined::encode(accepted + length, getID(), newID,
+                                         joinName);
+        Roster roster;
         for(NodeID i = 1; i <= maxID; i++)
         {
-          if(used[i])
+          if(used[i] && !roster.add(i, names[i]))
           {
-            ClientInfo clientInfo(i, names[i]);
-            send(clientInfo, newID);
+            enqueueReliable(roster, getID(), 0, newID, addrs[newID]);
+            roster = Roster();
+            roster.add(i, names[i]);
           }
         }
-        return true;
+        enqueueReliable(roster, getID(), 0, newID, addrs[newID]);
+        transmitReliable(newID);
+        continue;
       }
       
       // Other type of packet; verify source
       NodeID sourceID = result.getSource();
       if(sourceID > 0 && sourceID <= maxID && used[sourceID] &&
+         shardOf[sourceID] == shard &&
          recvAddr.sin_addr.s_addr == addrs[sourceID].sin_addr.s_addr &&
          recvAddr.sin_port == addrs[sourceID].sin_port)
       {
-        // Client left. Notify all clients of exit.
-        if(result.isType<Leaving>())
+        lastSeen[sourceID] = now;
+        
+        // Unwrap reliable packets. Those on ordered channels are delivered
+        // after the datagrams of the current recv call.
+        if(result.isType<Reliable>())
         {
-          ClientLeft clientLeft(sourceID, ClientLeft::NORMAL, "");
-          sendExclude(clientLeft, sourceID);
-          used[sourceID] = false;
+          bool isOrdered = unwrap(result, sourceID, recvAddr, unwrapped);
+          for(size_t i = 0; i < unwrapped.size();
+              i += PacketView(unwrapped.data() + i).getLength())
+            deliver(unwrapped.data() + i, sourceID, isOrdered, accepted,
+                    length);
+          continue;
         }
-        return true;
+        if(result.isType<Ack>())
+        {
+          acknowledge(result, sourceID);
+          continue;
+        }
+        deliver(datagram.data + offset, sourceID, false, accepted, length);
       }
-      throw Failure("packet recieved from unknown source");
+      else
+        unknown = true;
     }
-    return false;
+    memcpy(datagram.data, accepted, length);
+    datagram.length = length;
+    return length > 0 || !unknown;
+  }
+  void Server::deliver(const uint8_t* bytes, NodeID sourceID, bool isOrdered,
+                       uint8_t* accepted, size_t& length)
+  {
+    PacketView packet(bytes);
+    if(packet.getSource() != sourceID)
+      return;
+    
+    // Reassembled packets are too large to share a datagram, so they are
+    // delivered after the datagrams of the current recv call
+    if(packet.isType<Fragment>())
+    {
+      const vector<uint8_t>* whole = reassemble(packet, sourceID);
+      if(whole && PacketView(whole->data()).getSource() == sourceID)
+        release(whole->data(), whole->size());
+      return;
+    }
+    
+    // Control packets are consumed, except that the caller also sees a
+    // client leave
+    if(control.hasHandler(packet.getType()))
+    {
+      control.dispatch(packet);
+      if(!packet.isType<Leaving>())
+        return;
+    }
+    if(isOrdered)
+      release(bytes, packet.getLength());
+    else
+    {
+      memcpy(accepted + length, bytes, packet.getLength());
+      length += packet.getLength();
+    }
+  }
+  void Server::onHeartbeat(const Heartbeat&)
+  {
+  }
+  void Server::onTimeRequest(const TimeRequest& timeRequest)
+  {
+    // Both the arrival and the reply are stamped, so that the client can
+    // take the time spent here out of the round trip
+    uint64_t received = std::chrono::duration_cast<std::chrono::microseconds>(
+      arrival - started).count();
+    uint64_t sent = std::chrono::duration_cast<std::chrono::microseconds>(
+      NetClock::now() - started).count();
+    send(TimeResponse(timeRequest.clientTime(), received, sent),
+         timeRequest.getSource());
+  }
+  void Server::onLeaving(const Leaving& leaving)
+  {
+    leave(leaving.getSource());
   }
   void Server::kick(NodeID ID, string reason)
   {
+    RosterLock lock(rosterMutex);
     if(ID == 0)
       throw InvalidArgument("ID", "zero");
     if(ID > getMaxID())
@@ -205,8 +795,8 @@ namespace wic
       throw InvalidArgument("reason length", "> 50");
     
     send(Kick(reason), ID);
-    sendExclude(ClientLeft(ID, ClientLeft::KICKED, reason), ID);
-    used[ID] = false;
+    reliableBroadcast(ClientLeft(ID, ClientLeft::KICKED, reason), ID, 0, true);
+    disconnect(ID);
   }
   void Server::kick(string nameOrIP, string reason)
   {
@@ -214,6 +804,7 @@ namespace wic
   }
   void Server::ban(NodeID ID)
   {
+    RosterLock lock(rosterMutex);
     if(ID < 1)
       throw InvalidArgument("ID", "zero");
     if(ID > getMaxID())
@@ -221,45 +812,128 @@ namespace wic
     if(!used[ID])
       throw InvalidArgument("ID", "unused");
     
-    blacklist.push_back(names[ID]);
+    blacklist.insert(names[ID]);
     send(Ban(""), ID);
-    sendExclude(ClientLeft(ID, ClientLeft::BANNED, ""), ID);
-    used[ID] = false;
+    reliableBroadcast(ClientLeft(ID, ClientLeft::BANNED, ""), ID, 0, true);
+    disconnect(ID);
   }
   void Server::ban(string nameOrIP)
   {
+    RosterLock lock(rosterMutex);
     try
     {
       ban(getNodeID(nameOrIP));
     }
     catch (Error error)
     {
-      blacklist.push_back(nameOrIP);
+      blacklist.insert(nameOrIP);
     }
   }
   void Server::unban(string nameOrIP)
   {
-    bool found = false;
-    for(unsigned i = 0; i < blacklist.size(); i++)
+    RosterLock lock(rosterMutex);
+    if(blacklist.erase(nameOrIP) == 0)
+      throw Error("nameOrIP is not banned");
+  }
+  NodeID Server::getNodeID(string nameOrIP) const
+  {
+    RosterLock lock(rosterMutex);
+    // Names and IPs may be shared; the lowest matching ID wins
+    auto range = clientIndex.equal_range(nameOrIP);
+    if(range.first == range.second)
+      throw Error("nameOrIP corresponds to no client");
+    NodeID result = range.first->second;
+    for(auto entry = range.first; entry != range.second; ++entry)
     {
-      if(nameOrIP == blacklist[i])
+      if(entry->second < result)
+        result = entry->second;
+    }
+    return result;
+  }
+  void Server::connect(NodeID ID, const struct sockaddr_in& clientAddr,
+                       const string& clientName, const string& ip,
+                       unsigned shard)
+  {
+    addrs[ID] = clientAddr;
+    used[ID] = true;
+    names[ID] = clientName;
+    ips[ID] = ip;
+    shardOf[ID] = shard;
+    freeIDs[ID / 64] &= ~((uint64_t) 1 << (ID % 64));
+    clientIndex.insert(std::make_pair(clientName, ID));
+    clientIndex.insert(std::make_pair(ip, ID));
+    if(ID != 0)
+    {
+      addrIndex[addrKey(clientAddr)] = ID;
+      lastSeen[ID] = NetClock::now();
+      if(timeout > NetClock::duration::zero())
+        timeouts.schedule(ID, lastSeen[ID] + timeout);
+      generations[ID]++;
+      clientCount++;
+      setBudget(ID, bandwidth);
+    }
+  }
+  void Server::leave(NodeID ID)
+  {
+    // Client left. Notify all clients of exit.
+    if(!used[ID])
+      return;
+    ClientLeft clientLeft(ID, ClientLeft::NORMAL, "");
+    reliableBroadcast(clientLeft, ID, 0, true);
+    disconnect(ID);
+  }
+  void Server::expire(NetClock::time_point now)
+  {
+    // Timers are only moved forward lazily. A client heard from since its
+    // timer was set is simply checked again later.
+    timeouts.advance(now, expired);
+    for(size_t i = 0; i < expired.size(); i++)
+    {
+      NodeID ID = expired[i];
+      if(!used[ID])
+        continue;
+      if(lastSeen[ID] + timeout > now)
       {
-        blacklist.erase(blacklist.begin() + i);
-        i--;
-        found = true;
+        timeouts.schedule(ID, lastSeen[ID] + timeout);
+        continue;
       }
+      ClientLeft clientLeft(ID, ClientLeft::TIMED_OUT, "");
+      reliableBroadcast(clientLeft, ID, 0, true);
+      uint8_t bytes[AbstractPacket::HEADER_SIZE + ClientLeft::SIZE];
+      size_t length = clientLeft.toBuffer(bytes, sizeof(bytes), getID());
+      release(bytes, length);
+      disconnect(ID);
     }
-    if(!found)
-      throw Error("nameOrIP is not banned");
   }
-  NodeID Server::getNodeID(string nameOrIP) const
+  void Server::disconnect(NodeID ID)
   {
-
-    for(unsigned i = 0; i <= maxID; i++)
+    // Queued packets are still owed to the departing client, but nothing
+    // more is retransmitted
+    flush(ID);
+    resetPeer(ID);
+    interest.removeView(ID);
+    unindex(names[ID], ID);
+    unindex(ips[ID], ID);
+    addrIndex.erase(addrKey(addrs[ID]));
+    timeouts.cancel(ID);
+    used[ID] = false;
+    freeIDs[ID / 64] |= (uint64_t) 1 << (ID % 64);
+    clientCount--;
+  }
+  void Server::unindex(const string& key, NodeID ID)
+  {
+    auto range = clientIndex.equal_range(key);
+    for(auto entry = range.first; entry != range.second; ++entry)
     {
-      if(used[i] && (nameOrIP == names[i] || nameOrIP == ips[i]))
-        return i;
+      if(entry->second == ID)
+      {
+        clientIndex.erase(entry);
+        return;
+      }
     }
-    throw Error("nameOrIP corresponds to no client");
+  }
+  uint64_t Server::addrKey(const struct sockaddr_in& addr)
+  {
+    return ((uint64_t) addr.sin_addr.s_addr << 16) | addr.sin_port;
   }
 }
@@ -0,0 +1,126 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    TimerWheel.cpp
+ * ----------------------------------------------------------------------------
+ */
+#include "TimerWheel.h"
+namespace wic
+{
+  const uint32_t TimerWheel::NONE;
+  TimerWheel::Timer::Timer()
+  : due(0), prev(NONE), next(NONE), scheduled(false)
+  {
+  }
+  TimerWheel::TimerWheel(size_t slots, double resolution)
+  : heads(slots, NONE), mask(slots - 1), resolution(resolution),
+    origin(NetClock::now()), current(0), size(0)
+  {
+    if(slots == 0 || (slots & (slots - 1)) != 0)
+      throw InvalidArgument("slots", "not a power of two");
+    if(!(resolution > 0.0))
+      throw InvalidArgument("resolution", "<= 0");
+  }
+  void TimerWheel::schedule(uint16_t key, NetClock::time_point when)
+  {
+    if(key >= timers.size())
+      timers.resize((size_t) key + 1);
+    if(timers[key].scheduled)
+      unlink(key);
+    
+    // Timers already due fire on the next tick
+    uint64_t due = tickOf(when);
+    if(due <= current)
+      due = current + 1;
+    Timer& timer = timers[key];
+    uint32_t& head = heads[due & mask];
+    timer.due = due;
+    timer.prev = NONE;
+    timer.next = head;
+    timer.scheduled = true;
+    if(head != NONE)
+      timers[head].prev = key;
+    head = key;
+    size++;
+  }
+  void TimerWheel::cancel(uint16_t key)
+  {
+    if(key < timers.size() && timers[key].scheduled)
+      unlink(key);
+  }
+  bool TimerWheel::isScheduled(uint16_t key) const
+  {
+    return key < timers.size() && timers[key].scheduled;
+  }
+  size_t TimerWheel::getSize() const
+  {
+    return size;
+  }
+  void TimerWheel::advance(NetClock::time_point now,
+                           vector<uint16_t>& expired)
+  {
+    expired.clear();
+    std::chrono::duration<double> elapsed = now - origin;
+    if(elapsed.count() < 0.0)
+      return;
+    uint64_t target = (uint64_t) (elapsed.count() / resolution);
+    if(target <= current)
+      return;
+    
+    // After a full turn every slot has been visited, whatever the gap
+    uint64_t ticks = target - current;
+    if(ticks > heads.size())
+      ticks = heads.size();
+    for(uint64_t tick = current + 1; tick <= current + ticks; tick++)
+    {
+      uint32_t key = heads[tick & mask];
+      while(key != NONE)
+      {
+        uint32_t next = timers[key].next;
+        if(timers[key].due <= target)
+        {
+          unlink(key);
+          expired.push_back(key);
+        }
+        key = next;
+      }
+    }
+    current = target;
+  }
+  uint64_t TimerWheel::tickOf(NetClock::time_point when) const
+  {
+    // Round up, so that timers never fire early
+    std::chrono::duration<double> offset = when - origin;
+    if(offset.count() <= 0.0)
+      return 0;
+    return (uint64_t) std::ceil(offset.count() / resolution);
+  }
+  void TimerWheel::unlink(uint16_t key)
+  {
+    Timer& timer = timers[key];
+    if(timer.prev != NONE)
+      timers[timer.prev].next = timer.next;
+    else
+      heads[timer.due & mask] = timer.next;
+    if(timer.next != NONE)
+      timers[timer.next].prev = timer.prev;
+    timer.prev = NONE;
+    timer.next = NONE;
+    timer.scheduled = false;
+    size--;
+  }
+}
@@ -0,0 +1,223 @@
+/* ----------------------------------------------------------------------------
+ * wic - a simple 2D game engine for MacOS written in C++
+ * Copyright (C) 2013-2017  Willis O'Leary
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ * ----------------------------------------------------------------------------
+ * File:    Transport.cpp
+ * ----------------------------------------------------------------------------
+ */
+#include "Transport.h"
+namespace wic
+{
+  Transport::~Transport()
+  {
+  }
+  
+  size_t SocketTransport::recv(int fd, Datagram* const* datagrams,
+                               size_t bufferSize, size_t max)
+  {
+    const socklen_t lenAddr = sizeof(struct sockaddr_in);
+#ifdef __linux__
+    struct mmsghdr msgs[BATCH_SIZE];
+    struct iovec iovecs[BATCH_SIZE];
+    bzero(msgs, max * sizeof(struct mmsghdr));
+    for(size_t i = 0; i < max; i++)
+    {
+      iovecs[i].iov_base = datagrams[i]->data;
+      iovecs[i].iov_len = bufferSize;
+      msgs[i].msg_hdr.msg_name = &datagrams[i]->addr;
+      msgs[i].msg_hdr.msg_namelen = lenAddr;
+      msgs[i].msg_hdr.msg_iov = &iovecs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int result = recvmmsg(fd, msgs, max, MSG_DONTWAIT, nullptr);
+    if(result <= 0)
+      return 0;
+    for(int i = 0; i < result; i++)
+    {
+      if(msgs[i].msg_hdr.msg_namelen == lenAddr)
+        datagrams[i]->length = msgs[i].msg_len;
+      else
+        datagrams[i]->length = 0;
+    }
+    return result;
+#else
+    size_t received = 0;
+    for(; received < max; received++)
+    {
+      socklen_t tmpLen = lenAddr;
+      ssize_t length = recvfrom(fd, datagrams[received]->data, bufferSize, 0,
+                                (struct sockaddr*) &datagrams[received]->addr,
+                                &tmpLen);
+      if(length <= 0)
+        break;
+      datagrams[received]->length = (tmpLen == lenAddr) ? length : 0;
+    }
+    return received;
+#endif
+  }
+  void SocketTransport::send(int fd, const Datagram* datagrams, size_t count)
+  {
+    const socklen_t lenAddr = sizeof(struct sockaddr_in);
+    size_t sent = 0;
+#ifdef __linux__
+    struct mmsghdr msgs[BATCH_SIZE];
+    struct iovec iovecs[BATCH_SIZE];
+    while(sent < count)
+    {
+      size_t chunk = count - sent;
+      if(chunk > BATCH_SIZE)
+        chunk = BATCH_SIZE;
+      bzero(msgs, chunk * sizeof(struct mmsghdr));
+      for(size_t i = 0; i < chunk; i++)
+      {
+        iovecs[i].iov_base = datagrams[sent + i].data;
+        iovecs[i].iov_len = datagrams[sent + i].length;
+        msgs[i].msg_hdr.msg_name = (void*) &datagrams[sent + i].addr;
+        msgs[i].msg_hdr.msg_namelen = lenAddr;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+      int result = sendmmsg(fd, msgs, chunk, 0);
+      // The first datagram could not be sent; drop it and move on
+      if(result <= 0)
+        sent++;
+      else
+        sent += result;
+    }
+#else
+    for(; sent < count; sent++)
+      sendto(fd, datagrams[sent].data, datagrams[sent].length, 0,
+             (struct sockaddr*) &datagrams[sent].addr, lenAddr);
+#endif
+  }
+  
+  ImpairedTransport::ImpairedTransport(uint32_t seed)
+  : state(seed * 2654435761u ^ 0x9E3779B9u), latency(0.0), jitter(0.0),
+    loss(0.0), duplication(0.0), reordering(0.0), reorderDelay(0.0)
+  {
+    // Spread small seeds across the state (xorshift's first outputs from a
+    // small state are small too) and keep the state nonzero
+    if(state == 0)
+      state = 0x9E3779B9u;
+    for(unsigned i = 0; i < 8; i++)
+      random();
+  }
+  void ImpairedTransport::setLatency(double seconds)
+  {
+    if(!(seconds >= 0.0))
+      throw InvalidArgument("seconds", "< 0");
+    std::lock_guard<std::mutex> lock(mutex);
+    latency = seconds;
+  }
+  void ImpairedTransport::setJitter(double seconds)
+  {
+    if(!(seconds >= 0.0))
+      throw InvalidArgument("seconds", "< 0");
+    std::lock_guard<std::mutex> lock(mutex);
+    jitter = seconds;
+  }
+  void ImpairedTransport::setLoss(double probability)
+  {
+    if(!(probability >= 0.0 && probability <= 1.0))
+      throw InvalidArgument("probability", "outside 0-1");
+    std::lock_guard<std::mutex> lock(mutex);
+    loss = probability;
+  }
+  void ImpairedTransport::setDuplication(double probability)
+  {
+    if(!(probability >= 0.0 && probability <= 1.0))
+      throw InvalidArgument("probability", "outside 0-1");
+    std::lock_guard<std::mutex> lock(mutex);
+    duplication = probability;
+  }
+  void ImpairedTransport::setReordering(double probability, double delay)
+  {
+    if(!(probability >= 0.0 && probability <= 1.0))
+      throw InvalidArgument("probability", "outside 0-1");
+    if(!(delay >= 0.0))
+      throw InvalidArgument("delay", "< 0");
+    std::lock_guard<std::mutex> lock(mutex);
+    reordering = probability;
+    reorderDelay = delay;
+  }
+  size_t ImpairedTransport::getHeld() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return held.size();
+  }
+  size_t ImpairedTransport::recv(int fd, Datagram* const* datagrams,
+                                 size_t bufferSize, size_t max)
+  {
+    release(NetClock::now());
+    return kernel.recv(fd, datagrams, bufferSize, max);
+  }
+  void ImpairedTransport::send(int fd, const Datagram* datagrams, size_t count)
+  {
+    NetClock::time_point now = NetClock::now();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for(size_t i = 0; i < count; i++)
+      {
+        // Draw every decision for every datagram, so that the fate of one
+        // datagram never depends on the settings applied to another
+        bool dropped = random() < loss;
+        bool duplicated = random() < duplication;
+        for(unsigned copy = 0; copy < 2; copy++)
+        {
+          double delay = latency + jitter * (2.0 * random() - 1.0);
+          if(random() < reordering)
+            delay += reorderDelay;
+          if(dropped || (copy == 1 && !duplicated))
+            continue;
+          if(delay < 0.0)
+            delay = 0.0;
+          Held datagram;
+          datagram.fd = fd;
+          datagram.addr = datagrams[i].addr;
+          datagram.data.assign(datagrams[i].data,
+                               datagrams[i].data + datagrams[i].length);
+          NetClock::time_point due = now +
+            std::chrono::duration_cast<NetClock::duration>(
+              std::chrono::duration<double>(delay));
+          held.insert(std::make_pair(due, std::move(datagram)));
+        }
+      }
+    }
+    release(now);
+  }
+  double ImpairedTransport::random()
+  {
+    // xorshift32; identical on every platform
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state / 4294967296.0;
+  }
+  void ImpairedTransport::release(NetClock::time_point now)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    while(!held.empty() && held.begin()->first <= now)
+    {
+      Held& datagram = held.begin()->second;
+      Datagram out;
+      out.data = datagram.data.data();
+      out.length = datagram.data.size();
+      out.addr = datagram.addr;
+      kernel.send(datagram.fd, &out, 1);
+      held.erase(held.begin());
+    }
+  }
+}